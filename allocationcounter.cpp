@@ -0,0 +1,72 @@
+#include "allocationcounter.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <stdlib.h>
+
+#include <new>
+
+// Constant initialized, so the first access of a thread doesn't allocate itself
+static thread_local unsigned long long allocations = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+
+	void *ptr = malloc(size > 0 ? size : 1);
+
+	if (ptr == NULL)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	allocations++;
+	return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+bool AllocationCounter::IsEnabled()
+{
+	return true;
+}
+
+unsigned long long AllocationCounter::GetCount()
+{
+	return allocations;
+}
+
+#else
+
+bool AllocationCounter::IsEnabled()
+{
+	return false;
+}
+
+unsigned long long AllocationCounter::GetCount()
+{
+	return 0;
+}
+
+#endif // COUNT_ALLOCATIONS
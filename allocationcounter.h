@@ -0,0 +1,19 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+// AllocationCounter counts calls of the global operator new, separately for each thread.
+// Counting is only compiled in with COUNT_ALLOCATIONS defined (see CMakeLists.txt), otherwise
+// the count stays 0.
+class AllocationCounter
+{
+	virtual ~AllocationCounter() = 0;
+
+public:
+	static bool IsEnabled();
+
+	// Number of allocations made by the calling thread since it started, so work on other
+	// threads doesn't show up
+	static unsigned long long GetCount();
+};
+
+#endif // ALLOCATION_COUNTER_H
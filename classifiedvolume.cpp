@@ -0,0 +1,274 @@
+#include "classifiedvolume.h"
+#include "hash.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Entries of a transfer function row
+static const int ROW_LENGTH = 4096;
+
+std::atomic<unsigned int> ClassifiedVolume::nextversion(1);
+
+ClassifiedVolume::ClassifiedVolume() : quit(false), pending(false), busy(false), modulate(false), generation(0)
+{
+	memset(this->dim, 0, sizeof(this->dim));
+}
+
+ClassifiedVolume::~ClassifiedVolume()
+{
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		Cancel(lock);
+
+		this->quit = true;
+		this->wakeup.notify_one();
+	}
+
+	if (this->thread.joinable())
+		this->thread.join();
+}
+
+void ClassifiedVolume::Cancel(std::unique_lock<std::mutex> &lock)
+{
+	this->generation++;
+	this->pending = false;
+
+	this->idle.wait(lock, [this] { return !this->busy; });
+}
+
+void ClassifiedVolume::SetVolume(const float *densities, const int dim[3])
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	Cancel(lock);
+
+	memcpy(this->dim, dim, sizeof(this->dim));
+
+	const size_t count = (size_t)dim[0] * dim[1] * dim[2];
+	this->entries.resize(count);
+	this->modulation.resize(count);
+
+	// Gradients are central differences with clamped borders, like the ray caster computes
+	// them at voxel centers
+	ParallelFor(dim[2], [&](int z)
+	{
+		const size_t slice = (size_t)dim[0] * dim[1];
+
+		for (int y = 0; y < dim[1]; y++)
+		{
+			for (int x = 0; x < dim[0]; x++)
+			{
+				const size_t voxel = z * slice + (size_t)y * dim[0] + x;
+				const float *d = densities + voxel;
+
+				this->entries[voxel] = (uint16_t)std::min(ROW_LENGTH - 1, (int)(*d * ROW_LENGTH));
+
+				const float gx = (x + 1 < dim[0] ? d[1] : *d) - (x > 0 ? d[-1] : *d);
+				const float gy = (y + 1 < dim[1] ? d[dim[0]] : *d) - (y > 0 ? d[-dim[0]] : *d);
+				const float gz = (z + 1 < dim[2] ? d[slice] : *d) - (z > 0 ? d[-(ptrdiff_t)slice] : *d);
+
+				const float opacity = std::min(0.8f + 5.0f * sqrtf(gx * gx + gy * gy + gz * gz), 1.0f);
+				this->modulation[voxel] = (unsigned char)(opacity * 255.0f + 0.5f);
+			}
+		}
+	});
+
+	this->bricks.clear();
+
+	size_t offset = 0;
+
+	for (int z = 0; z < dim[2]; z += BRICK_SIZE)
+	{
+		for (int y = 0; y < dim[1]; y += BRICK_SIZE)
+		{
+			for (int x = 0; x < dim[0]; x += BRICK_SIZE)
+			{
+				Brick brick;
+				brick.origin[0] = x;
+				brick.origin[1] = y;
+				brick.origin[2] = z;
+				brick.size[0] = std::min(BRICK_SIZE, dim[0] - x);
+				brick.size[1] = std::min(BRICK_SIZE, dim[1] - y);
+				brick.size[2] = std::min(BRICK_SIZE, dim[2] - z);
+				brick.offset = offset;
+				brick.min = 0;
+				brick.max = 0;
+				brick.hash = 0;
+				brick.version = 0;
+
+				this->bricks.push_back(brick);
+				offset += (size_t)brick.size[0] * brick.size[1] * brick.size[2] * 4;
+			}
+		}
+	}
+
+	ParallelFor((int)this->bricks.size(), [&](int i)
+	{
+		Brick &brick = this->bricks[i];
+
+		int min = ROW_LENGTH - 1;
+		int max = 0;
+
+		for (int z = brick.origin[2]; z < brick.origin[2] + brick.size[2]; z++)
+		{
+			for (int y = brick.origin[1]; y < brick.origin[1] + brick.size[1]; y++)
+			{
+				const uint16_t *entry = &this->entries[((size_t)z * dim[1] + y) * dim[0] + brick.origin[0]];
+
+				for (int x = 0; x < brick.size[0]; x++)
+				{
+					min = std::min(min, (int)entry[x]);
+					max = std::max(max, (int)entry[x]);
+				}
+			}
+		}
+
+		brick.min = min;
+		brick.max = max;
+	});
+
+	this->voxels.assign(offset, 0);
+}
+
+void ClassifiedVolume::SetTransferFunction(const unsigned char *row, bool modulation)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+
+	this->row.assign(row, row + ROW_LENGTH * 4);
+	this->modulate = modulation;
+
+	// The worker picks up the new job as soon as the current one has stopped
+	this->generation++;
+	this->pending = true;
+
+	if (!this->thread.joinable())
+		this->thread = std::thread(&ClassifiedVolume::Run, this);
+
+	this->wakeup.notify_one();
+}
+
+bool ClassifiedVolume::IsBaking()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	return this->pending || this->busy;
+}
+
+void ClassifiedVolume::Run()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+
+	for (;;)
+	{
+		this->wakeup.wait(lock, [this] { return this->quit || this->pending; });
+
+		if (this->quit)
+			return;
+
+		// Copied, so the next job can be queued while this one is running
+		const std::vector<unsigned char> row = this->row;
+		const bool modulate = this->modulate;
+		const unsigned int generation = this->generation;
+
+		this->pending = false;
+		this->busy = true;
+		lock.unlock();
+
+		// Bricks are only replaced by SetVolume, which waits until the job is done
+		ParallelFor((int)this->bricks.size(), [&](int i)
+		{
+			if (this->generation == generation)
+				BakeBrick(i, row.data(), modulate, generation);
+		});
+
+		lock.lock();
+		this->busy = false;
+		this->idle.notify_all();
+	}
+}
+
+void ClassifiedVolume::BakeBrick(int index, const unsigned char *row, bool modulate, unsigned int generation)
+{
+	Brick &brick = this->bricks[index];
+
+	// Hash of the entries used by the brick
+	Hash entries;
+	entries.Add(row + brick.min * 4, (size_t)(brick.max + 1 - brick.min) * 4);
+	entries.Add((unsigned char)(modulate ? 1 : 0));
+
+	const uint64_t hash = entries.Get();
+
+	// Only this job writes hash and version of the brick, so reading them needs no lock
+	if (brick.version != 0 && brick.hash == hash)
+		return;
+
+	std::vector<unsigned char> baked((size_t)brick.size[0] * brick.size[1] * brick.size[2] * 4);
+	unsigned char *out = baked.data();
+
+	for (int z = brick.origin[2]; z < brick.origin[2] + brick.size[2]; z++)
+	{
+		for (int y = brick.origin[1]; y < brick.origin[1] + brick.size[1]; y++)
+		{
+			const size_t first = ((size_t)z * this->dim[1] + y) * this->dim[0] + brick.origin[0];
+
+			for (int x = 0; x < brick.size[0]; x++)
+			{
+				const unsigned char *entry = row + this->entries[first + x] * 4;
+
+				out[0] = entry[0];
+				out[1] = entry[1];
+				out[2] = entry[2];
+				out[3] = modulate ? (unsigned char)((entry[3] * this->modulation[first + x] + 127) / 255) : entry[3];
+				out += 4;
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	// A cancelled brick keeps its previous voxels and hash, so the next job compares against
+	// what the brick actually holds
+	if (this->generation != generation)
+		return;
+
+	memcpy(&this->voxels[brick.offset], baked.data(), baked.size());
+	brick.hash = hash;
+	brick.version = nextversion++;
+}
+
+void ClassifiedVolume::Lock()
+{
+	this->mutex.lock();
+}
+
+void ClassifiedVolume::Unlock()
+{
+	this->mutex.unlock();
+}
+
+void ClassifiedVolume::GetDimensions(int dim[3])
+{
+	memcpy(dim, this->dim, sizeof(this->dim));
+}
+
+int ClassifiedVolume::GetBrickCount()
+{
+	return (int)this->bricks.size();
+}
+
+void ClassifiedVolume::GetBrick(int index, int origin[3], int size[3])
+{
+	memcpy(origin, this->bricks[index].origin, sizeof(this->bricks[index].origin));
+	memcpy(size, this->bricks[index].size, sizeof(this->bricks[index].size));
+}
+
+const unsigned char *ClassifiedVolume::GetBrickVoxels(int index)
+{
+	return &this->voxels[this->bricks[index].offset];
+}
+
+unsigned int ClassifiedVolume::GetBrickVersion(int index)
+{
+	return this->bricks[index].version;
+}
@@ -0,0 +1,110 @@
+#ifndef CLASSIFIED_VOLUME_H
+#define CLASSIFIED_VOLUME_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ClassifiedVolume bakes a volume and a single transfer function into premultiplied RGBA8
+// voxels, so the ray caster needs one fetch per sample and neither a transfer function lookup
+// nor a gradient. Baking happens on a background thread using all available hardware threads.
+// The volume is split into bricks and a new transfer function only rebakes those bricks whose
+// range of densities maps to changed entries. Setting another transfer function cancels the
+// bake in progress.
+class ClassifiedVolume
+{
+	struct Brick
+	{
+		int origin[3];
+		int size[3];
+
+		// Offset of the first voxel in voxels, in bytes
+		size_t offset;
+
+		// Range of transfer function entries used by the voxels of the brick
+		int min;
+		int max;
+
+		// Hash of the entries the brick has been baked with and the version of its voxels,
+		// 0 until it has been baked for the first time
+		uint64_t hash;
+		unsigned int version;
+	};
+
+	int dim[3];
+
+	// Transfer function entry and gradient magnitude modulation (0..255) of every voxel
+	std::vector<uint16_t> entries;
+	std::vector<unsigned char> modulation;
+
+	// Baked RGBA8 voxels, stored brick by brick
+	std::vector<unsigned char> voxels;
+	std::vector<Brick> bricks;
+
+	// Guards the job below as well as the voxels and versions of all bricks
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::condition_variable idle;
+	std::thread thread;
+
+	bool quit;
+	bool pending;
+	bool busy;
+
+	// Transfer function of the pending job and whether it includes modulation
+	std::vector<unsigned char> row;
+	bool modulate;
+
+	// Incremented for every job, a bake stops as soon as it no longer matches
+	std::atomic<unsigned int> generation;
+
+	static std::atomic<unsigned int> nextversion;
+
+	void Run();
+	void BakeBrick(int index, const unsigned char *row, bool modulate, unsigned int generation);
+
+	// Cancel stops the current job and waits until the worker threads are idle. The mutex
+	// must be held.
+	void Cancel(std::unique_lock<std::mutex> &lock);
+
+public:
+	// Edge length of the bricks in voxels
+	static const int BRICK_SIZE = 32;
+
+	ClassifiedVolume();
+	~ClassifiedVolume();
+
+	// SetVolume replaces the volume by normalized densities (0..1, x varying fastest). All
+	// bricks are empty until the next transfer function has been baked.
+	void SetVolume(const float *densities, const int dim[3]);
+
+	// SetTransferFunction starts baking the given 4096-entry row in the background. With
+	// modulation, the opacity of each voxel is scaled by its gradient magnitude, like the
+	// ray caster does for point classification.
+	void SetTransferFunction(const unsigned char *row, bool modulation);
+
+	// IsBaking returns true until the last transfer function has been baked completely
+	bool IsBaking();
+
+	// The brick accessors below may only be called while the volume is locked
+	void Lock();
+	void Unlock();
+
+	void GetDimensions(int dim[3]);
+	int GetBrickCount();
+	void GetBrick(int index, int origin[3], int size[3]);
+
+	// GetBrickVoxels returns the RGBA8 voxels of a brick, x varying fastest
+	const unsigned char *GetBrickVoxels(int index);
+
+	// GetBrickVersion returns a number which changes whenever the voxels of a brick change.
+	// Versions are unique across all instances. A brick which hasn't been baked yet has
+	// version 0.
+	unsigned int GetBrickVersion(int index);
+};
+
+#endif // CLASSIFIED_VOLUME_H
@@ -5,19 +5,57 @@ set(CPP_FILES
 	panel.cpp
 	transferfunctiondialog.cpp
 	volumemapper3d.cpp
+	allocationcounter.cpp
+	classifiedvolume.cpp
+	glstatecache.cpp
+	gputimer.cpp
+	gradienttransfertable.cpp
+	hash.cpp
 	opengl.cpp
+	parallel.cpp
+	preintegrationtable.cpp
+	profiler.cpp
+	rendertargetpool.cpp
+	programcache.cpp
+	resolutioncontroller.cpp
+	rollingstatistics.cpp
 	shaderprogram.cpp
+	shadingtable.cpp
+	transferfunctionbaker.cpp
+	transferfunctionfile.cpp
+	transferfunctionlibrary.cpp
+	transferfunctionlistmodel.cpp
+	transfertable.cpp
 )
 
 set(SRC_H_FILES
 	volumemapper3d.h
+	allocationcounter.h
+	classifiedvolume.h
+	glstatecache.h
+	gputimer.h
+	gradienttransfertable.h
+	hash.h
 	opengl.h
+	parallel.h
+	preintegrationtable.h
+	profiler.h
+	rendertargetpool.h
+	programcache.h
+	resolutioncontroller.h
+	rollingstatistics.h
 	shaderprogram.h
+	shadingtable.h
+	transferfunctionbaker.h
+	transferfunctionfile.h
+	transferfunctionlibrary.h
+	transfertable.h
 )
 
 set(MOC_H_FILES
 	panel.h
 	transferfunctiondialog.h
+	transferfunctionlistmodel.h
 )
 
 set(QRC_FILES
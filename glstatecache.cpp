@@ -0,0 +1,222 @@
+#include "glstatecache.h"
+#include "opengl.h"
+
+GLStateCache::GLStateCache() : issued(0), skipped(0), queries(0), lastissued(0), lastskipped(0), lastqueries(0)
+{
+	Forget();
+}
+
+int GLStateCache::GetTargetIndex(unsigned int target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_1D:
+		return 0;
+	case GL_TEXTURE_2D:
+		return 1;
+	case GL_TEXTURE_3D:
+		return 2;
+	case GL_TEXTURE_2D_ARRAY:
+		return 3;
+	case GL_TEXTURE_1D_ARRAY:
+		return 4;
+	default:
+		return -1;
+	}
+}
+
+void GLStateCache::Begin()
+{
+	this->lastissued = this->issued;
+	this->lastskipped = this->skipped;
+	this->lastqueries = this->queries;
+
+	this->issued = 0;
+	this->skipped = 0;
+	this->queries = 0;
+
+	Forget();
+}
+
+void GLStateCache::Forget()
+{
+	this->drawframebuffer = UNKNOWN;
+	this->readframebuffer = UNKNOWN;
+	this->program = UNKNOWN;
+	this->vertexarray = UNKNOWN;
+	this->arraybuffer = UNKNOWN;
+	this->activetexture = UNKNOWN;
+	this->blend = -1;
+
+	for (int i = 0; i < TEXTURE_UNITS; i++)
+	{
+		for (int j = 0; j < TEXTURE_TARGETS; j++)
+			this->textures[i][j] = UNKNOWN;
+	}
+}
+
+unsigned int GLStateCache::GetDrawFramebuffer()
+{
+	if (this->drawframebuffer == UNKNOWN)
+	{
+		GLint binding;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &binding);
+		this->drawframebuffer = binding;
+		this->queries++;
+	}
+
+	return this->drawframebuffer;
+}
+
+unsigned int GLStateCache::GetReadFramebuffer()
+{
+	if (this->readframebuffer == UNKNOWN)
+	{
+		GLint binding;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &binding);
+		this->readframebuffer = binding;
+		this->queries++;
+	}
+
+	return this->readframebuffer;
+}
+
+void GLStateCache::BindFramebuffer(unsigned int target, unsigned int framebuffer)
+{
+	const bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+	const bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+	if ((!draw || this->drawframebuffer == framebuffer) && (!read || this->readframebuffer == framebuffer))
+	{
+		this->skipped++;
+		return;
+	}
+
+	glBindFramebuffer(target, framebuffer);
+	this->issued++;
+
+	if (draw)
+		this->drawframebuffer = framebuffer;
+
+	if (read)
+		this->readframebuffer = framebuffer;
+}
+
+void GLStateCache::UseProgram(unsigned int program)
+{
+	if (this->program == program)
+	{
+		this->skipped++;
+		return;
+	}
+
+	glUseProgram(program);
+	this->issued++;
+	this->program = program;
+}
+
+void GLStateCache::BindVertexArray(unsigned int vertexarray)
+{
+	if (this->vertexarray == vertexarray)
+	{
+		this->skipped++;
+		return;
+	}
+
+	glBindVertexArray(vertexarray);
+	this->issued++;
+	this->vertexarray = vertexarray;
+}
+
+void GLStateCache::BindBuffer(unsigned int target, unsigned int buffer)
+{
+	// The element array binding is part of the vertex array state and not tracked
+	if (target != GL_ARRAY_BUFFER)
+	{
+		glBindBuffer(target, buffer);
+		this->issued++;
+		return;
+	}
+
+	if (this->arraybuffer == buffer)
+	{
+		this->skipped++;
+		return;
+	}
+
+	glBindBuffer(target, buffer);
+	this->issued++;
+	this->arraybuffer = buffer;
+}
+
+void GLStateCache::ActiveTexture(unsigned int unit)
+{
+	if (this->activetexture == unit)
+	{
+		this->skipped++;
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + unit);
+	this->issued++;
+	this->activetexture = unit;
+}
+
+void GLStateCache::BindTexture(unsigned int target, unsigned int texture)
+{
+	const int index = GetTargetIndex(target);
+	const unsigned int unit = this->activetexture;
+
+	// Untracked target or unit, or the active unit is unknown
+	if (index < 0 || unit >= TEXTURE_UNITS)
+	{
+		glBindTexture(target, texture);
+		this->issued++;
+		return;
+	}
+
+	if (this->textures[unit][index] == texture)
+	{
+		this->skipped++;
+		return;
+	}
+
+	glBindTexture(target, texture);
+	this->issued++;
+	this->textures[unit][index] = texture;
+}
+
+bool GLStateCache::IsBlendEnabled()
+{
+	if (this->blend < 0)
+	{
+		this->blend = glIsEnabled(GL_BLEND) ? 1 : 0;
+		this->queries++;
+	}
+
+	return this->blend == 1;
+}
+
+void GLStateCache::SetBlendEnabled(bool enabled)
+{
+	if (this->blend == (enabled ? 1 : 0))
+	{
+		this->skipped++;
+		return;
+	}
+
+	if (enabled)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+
+	this->issued++;
+	this->blend = enabled ? 1 : 0;
+}
+
+void GLStateCache::GetFrameCounts(int &issued, int &skipped, int &queries)
+{
+	issued = this->lastissued;
+	skipped = this->lastskipped;
+	queries = this->lastqueries;
+}
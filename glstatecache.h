@@ -0,0 +1,67 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+// GLStateCache shadows the GL bindings changed by the mapper during a frame. Binds which
+// would not change anything are skipped, and the framebuffer bindings and capabilities of
+// the caller are queried at most once per frame instead of on every save. State which has
+// not been set since Begin is unknown, so the first bind of each kind is always issued.
+// All GL calls have to go through the cache between Begin and the end of the frame.
+class GLStateCache
+{
+	static const unsigned int UNKNOWN = ~0u;
+
+	// OpenGL 3.3 guarantees 16 units for fragment shaders
+	static const int TEXTURE_UNITS = 16;
+	static const int TEXTURE_TARGETS = 5;
+
+	unsigned int drawframebuffer;
+	unsigned int readframebuffer;
+	unsigned int program;
+	unsigned int vertexarray;
+	unsigned int arraybuffer;
+	unsigned int activetexture;
+	unsigned int textures[TEXTURE_UNITS][TEXTURE_TARGETS];
+	int blend;
+
+	int issued;
+	int skipped;
+	int queries;
+
+	int lastissued;
+	int lastskipped;
+	int lastqueries;
+
+	static int GetTargetIndex(unsigned int target);
+
+public:
+	GLStateCache();
+
+	// Begin starts a new frame. Everything is assumed to be changed by code outside of
+	// the mapper, and the counters of the previous frame are kept for GetFrameCounts.
+	void Begin();
+
+	unsigned int GetDrawFramebuffer();
+	unsigned int GetReadFramebuffer();
+	void BindFramebuffer(unsigned int target, unsigned int framebuffer);
+
+	void UseProgram(unsigned int program);
+	void BindVertexArray(unsigned int vertexarray);
+	void BindBuffer(unsigned int target, unsigned int buffer);
+
+	// ActiveTexture takes the unit index, not GL_TEXTUREi
+	void ActiveTexture(unsigned int unit);
+	void BindTexture(unsigned int target, unsigned int texture);
+
+	bool IsBlendEnabled();
+	void SetBlendEnabled(bool enabled);
+
+	// Forget must be called when a GL object known to the cache is deleted, because its
+	// name may be reused.
+	void Forget();
+
+	// GetFrameCounts returns the number of state changes issued to GL, those skipped as
+	// redundant and the state queries of the previous frame.
+	void GetFrameCounts(int &issued, int &skipped, int &queries);
+};
+
+#endif // GL_STATE_CACHE_H
@@ -0,0 +1,86 @@
+#include "gputimer.h"
+#include "opengl.h"
+
+GpuTimer::GpuTimer() : oldest(0), count(0), active(false)
+{
+	for (int i = 0; i < RING_SIZE; i++)
+	{
+		this->queries[i] = 0;
+		this->tags[i] = 0;
+	}
+}
+
+GpuTimer::~GpuTimer()
+{
+	Destroy();
+}
+
+void GpuTimer::Destroy()
+{
+	if (this->queries[0] != 0)
+	{
+		glDeleteQueries(RING_SIZE, this->queries);
+
+		for (int i = 0; i < RING_SIZE; i++)
+			this->queries[i] = 0;
+	}
+
+	this->oldest = 0;
+	this->count = 0;
+	this->active = false;
+}
+
+void GpuTimer::Begin(unsigned int tag)
+{
+	if (this->count == RING_SIZE)
+		return;
+
+	if (this->queries[0] == 0)
+	{
+		glGenQueries(RING_SIZE, this->queries);
+		CheckGLError();
+	}
+
+	const int slot = (this->oldest + this->count) % RING_SIZE;
+
+	glBeginQuery(GL_TIME_ELAPSED, this->queries[slot]);
+	this->tags[slot] = tag;
+	this->active = true;
+}
+
+void GpuTimer::End()
+{
+	if (!this->active)
+		return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+	this->active = false;
+	this->count++;
+}
+
+bool GpuTimer::Poll(float &ms, unsigned int *tag)
+{
+	if (this->count == 0)
+		return false;
+
+	const unsigned int query = this->queries[this->oldest];
+
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (!available)
+		return false;
+
+	GLuint64 ns = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+
+	ms = (float)((double)ns / 1.0e6);
+
+	if (tag != NULL)
+		*tag = this->tags[this->oldest];
+
+	this->oldest = (this->oldest + 1) % RING_SIZE;
+	this->count--;
+
+	return true;
+}
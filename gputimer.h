@@ -0,0 +1,40 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <stddef.h>
+
+// GpuTimer measures how long the GPU takes to execute a sequence of GL commands, using
+// GL_TIME_ELAPSED queries. Several measurements can be in flight at once and results are
+// only read after the GPU has made them available, so the timer never stalls the pipeline.
+// Results therefore arrive a few frames late. Only one GpuTimer may be active at a time.
+class GpuTimer
+{
+	static const int RING_SIZE = 4;
+
+	unsigned int queries[RING_SIZE];
+	unsigned int tags[RING_SIZE];
+
+	int oldest;
+	int count;
+	bool active;
+
+public:
+	GpuTimer();
+	~GpuTimer();
+
+	// Begin starts a new measurement. The tag is returned along with the result and can be
+	// used to tell apart measurements of different configurations. If all queries are still
+	// waiting for results, the measurement is skipped.
+	void Begin(unsigned int tag = 0);
+	void End();
+
+	// Poll retrieves the oldest finished measurement in milliseconds. Returns false if no
+	// result is available yet.
+	bool Poll(float &ms, unsigned int *tag = NULL);
+
+	// Destroy deletes all query objects. The GL context that was current when the timer
+	// was first used must be current.
+	void Destroy();
+};
+
+#endif // GPU_TIMER_H
@@ -0,0 +1,65 @@
+#include "gradienttransfertable.h"
+#include "hash.h"
+#include "transferfunctionbaker.h"
+
+#include <stddef.h>
+
+// Number of table lines built by one parallel work item
+static const int LINES_PER_TASK = 4;
+
+// Source entries averaged into a single table entry along each axis
+static const int DENSITY_FOOTPRINT = TransferFunctionBaker::SIZE / GradientTransferTable::WIDTH;
+static const int GRADIENT_FOOTPRINT = TransferFunctionBaker::GRADIENT_SIZE / GradientTransferTable::HEIGHT;
+
+GradientTransferTable::GradientTransferTable() : TransferTable(WIDTH, HEIGHT, LINES_PER_TASK)
+{
+}
+
+void GradientTransferTable::BuildLines(const unsigned char *row, const unsigned char *gradient, int first, int last, unsigned char *table)
+{
+	for (int y = first; y < last; y++)
+	{
+		// Average gradient opacity of this line, scaled to 0..255 * 255
+		int opacity = 255 * GRADIENT_FOOTPRINT;
+
+		if (gradient != NULL)
+		{
+			opacity = 0;
+			for (int i = 0; i < GRADIENT_FOOTPRINT; i++)
+				opacity += gradient[y * GRADIENT_FOOTPRINT + i];
+		}
+
+		unsigned char *out = table + (size_t)y * WIDTH * 4;
+
+		for (int x = 0; x < WIDTH; x++)
+		{
+			const unsigned char *in = row + x * DENSITY_FOOTPRINT * 4;
+
+			for (int c = 0; c < 4; c++)
+			{
+				int sum = 0;
+				for (int i = 0; i < DENSITY_FOOTPRINT; i++)
+					sum += in[i * 4 + c];
+
+				// Premultiplied values scale with the opacity in all channels
+				const int divisor = DENSITY_FOOTPRINT * GRADIENT_FOOTPRINT * 255;
+				out[x * 4 + c] = (unsigned char)((sum * opacity + divisor / 2) / divisor);
+			}
+		}
+	}
+}
+
+bool GradientTransferTable::UpdateRow(int row, const unsigned char *data, const unsigned char *gradient)
+{
+	// A missing gradient row hashes like a fully opaque one
+	Hash hash;
+	hash.Add(data, TransferFunctionBaker::SIZE * 4);
+
+	for (int i = 0; i < TransferFunctionBaker::GRADIENT_SIZE; i++)
+		hash.Add(gradient != NULL ? gradient[i] : (unsigned char)255);
+
+	return BuildRow(row, hash.Get(), [&](int first, int last, unsigned char *table)
+	{
+		BuildLines(data, gradient, first, last, table);
+	});
+}
@@ -0,0 +1,25 @@
+#ifndef GRADIENT_TRANSFER_TABLE_H
+#define GRADIENT_TRANSFER_TABLE_H
+
+#include "transfertable.h"
+
+// GradientTransferTable holds one two-dimensional transfer function per row of a library. Each
+// table is indexed by density along its width and by gradient magnitude along its height and
+// stores premultiplied RGBA8 values: the entries of the 4096-entry row scaled by the gradient
+// opacity. Both axes are box-filtered down from the source rows.
+class GradientTransferTable : public TransferTable
+{
+	// BuildLines fills the table lines [first, last), i.e. a range of gradient magnitudes
+	static void BuildLines(const unsigned char *row, const unsigned char *gradient, int first, int last, unsigned char *table);
+
+public:
+	// Entries along the density and the gradient magnitude axis
+	static const int WIDTH = 1024;
+	static const int HEIGHT = 64;
+
+	GradientTransferTable();
+
+	bool UpdateRow(int row, const unsigned char *data, const unsigned char *gradient);
+};
+
+#endif // GRADIENT_TRANSFER_TABLE_H
@@ -0,0 +1,43 @@
+#include "hash.h"
+
+static const uint64_t OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t PRIME = 1099511628211ULL;
+
+Hash::Hash() : value(OFFSET_BASIS)
+{
+}
+
+void Hash::Add(const unsigned char *data, size_t size)
+{
+	uint64_t hash = this->value;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= PRIME;
+	}
+
+	this->value = hash;
+}
+
+void Hash::Add(unsigned char byte)
+{
+	this->value ^= byte;
+	this->value *= PRIME;
+}
+
+void Hash::AddString(const char *str)
+{
+	if (str == NULL)
+		str = "";
+
+	do
+	{
+		Add((unsigned char)*str);
+	} while (*str++ != 0);
+}
+
+uint64_t Hash::Get() const
+{
+	return this->value;
+}
@@ -0,0 +1,26 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hash computes the 64 bit FNV-1a hash of a sequence of bytes, which may be added in several
+// parts. It is used to detect changed inputs and is not meant to resist deliberate collisions.
+class Hash
+{
+	uint64_t value;
+
+public:
+	Hash();
+
+	void Add(const unsigned char *data, size_t size);
+	void Add(unsigned char byte);
+
+	// AddString adds a zero terminated string including the terminating zero, which separates
+	// consecutive strings. NULL is added like an empty string.
+	void AddString(const char *str);
+
+	uint64_t Get() const;
+};
+
+#endif // HASH_H
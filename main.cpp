@@ -1,4 +1,8 @@
 #include "panel.h"
+#include "allocationcounter.h"
+#include "opengl.h"
+#include "transferfunctionbaker.h"
+#include "volumemapper3d.h"
 
 #include <mitkStandaloneDataStorage.h>
 
@@ -6,6 +10,10 @@
 
 #include <QApplication>
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 int main(int argc, char *argv[])
 {
 	QApplication app(argc, argv);
@@ -14,9 +22,69 @@ int main(int argc, char *argv[])
 	
 	QmitkRegisterClasses();
 
+	// --benchmark-tf-baking compares the transfer function baking paths and exits
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--benchmark-tf-baking") == 0)
+			return TransferFunctionBaker::Benchmark(stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	mitk::StandaloneDataStorage::Pointer datastorage = mitk::StandaloneDataStorage::New();
 
 	Panel panel;
+
+	// --gl-errors=off|async|strict selects how GL errors are reported
+	// --log-pass-times=N logs GPU times of all render passes every N frames
+	// --sample-cache=MB sets the memory of the sample cache, 0 disables it
+	// --shading=exact|table|compare selects how lighting and silhouettes are shaded
+	// --check-allocations=N cycles through render settings for N frames and quits
+	for (int i = 1; i < argc; i++)
+	{
+		static const char *erroroption = "--gl-errors=";
+		static const char *logoption = "--log-pass-times=";
+		static const char *cacheoption = "--sample-cache=";
+		static const char *shadingoption = "--shading=";
+		static const char *checkoption = "--check-allocations=";
+
+		if (strncmp(argv[i], erroroption, strlen(erroroption)) == 0)
+		{
+			OpenGL::ErrorMode mode;
+
+			if (OpenGL::ParseErrorMode(argv[i] + strlen(erroroption), mode))
+				OpenGL::SetErrorMode(mode);
+			else
+				fprintf(stderr, "Unknown GL error mode: %s (expected off, async or strict)\n", argv[i] + strlen(erroroption));
+		}
+		else if (strncmp(argv[i], logoption, strlen(logoption)) == 0)
+		{
+			panel.SetPassTimingLogInterval(atoi(argv[i] + strlen(logoption)));
+		}
+		else if (strncmp(argv[i], cacheoption, strlen(cacheoption)) == 0)
+		{
+			panel.SetSampleCacheBudget(atoi(argv[i] + strlen(cacheoption)));
+		}
+		else if (strncmp(argv[i], shadingoption, strlen(shadingoption)) == 0)
+		{
+			const char *mode = argv[i] + strlen(shadingoption);
+
+			if (strcmp(mode, "exact") == 0)
+				panel.SetShadingMode(VolumeMapper3D::ShadingMode::EXACT);
+			else if (strcmp(mode, "table") == 0)
+				panel.SetShadingMode(VolumeMapper3D::ShadingMode::TABLE);
+			else if (strcmp(mode, "compare") == 0)
+				panel.SetShadingMode(VolumeMapper3D::ShadingMode::COMPARE);
+			else
+				fprintf(stderr, "Unknown shading mode: %s (expected exact, table or compare)\n", mode);
+		}
+		else if (strncmp(argv[i], checkoption, strlen(checkoption)) == 0)
+		{
+			if (!AllocationCounter::IsEnabled())
+				fputs("Warning: Heap allocations are only counted in builds with COUNT_ALLOCATIONS\n", stderr);
+
+			panel.SetAllocationCheck(atoi(argv[i] + strlen(checkoption)));
+		}
+	}
+
 	panel.SetDataStorage(datastorage);
 	panel.show();
 
@@ -1,9 +1,16 @@
 #include "opengl.h"
 
 #include <stdio.h>
+#include <string.h>
 
 int OpenGL::initerror = 1;
 
+#ifdef NDEBUG
+OpenGL::ErrorMode OpenGL::errormode = OpenGL::OFF;
+#else
+OpenGL::ErrorMode OpenGL::errormode = OpenGL::STRICT;
+#endif
+
 bool OpenGL::Init()
 {
 	if (OpenGL::initerror > 0)
@@ -19,8 +26,94 @@ bool OpenGL::VersionSupported(int major, int minor)
 	return gl3wIsSupported(major, minor) != 0;
 }
 
+bool OpenGL::ExtensionSupported(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+	for (GLint i = 0; i < count; i++)
+	{
+		const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+
+		if (extension != NULL && strcmp(extension, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+void OpenGL::SetErrorMode(ErrorMode mode)
+{
+	OpenGL::errormode = mode;
+}
+
+OpenGL::ErrorMode OpenGL::GetErrorMode()
+{
+	return OpenGL::errormode;
+}
+
+bool OpenGL::ParseErrorMode(const char *name, ErrorMode &mode)
+{
+	if (strcmp(name, "off") == 0)
+		mode = OFF;
+	else if (strcmp(name, "async") == 0)
+		mode = ASYNC;
+	else if (strcmp(name, "strict") == 0)
+		mode = STRICT;
+	else
+		return false;
+
+	return true;
+}
+
+void OpenGL::ApplyErrorMode()
+{
+	// Available with OpenGL 4.3 or KHR_debug. Function pointers alone don't tell, GLX returns
+	// them for functions the context doesn't support.
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	const bool supported = (major > 4 || (major == 4 && minor >= 3) || ExtensionSupported("GL_KHR_debug")) && glDebugMessageCallback != NULL;
+
+	if (!supported)
+	{
+		if (OpenGL::errormode == ASYNC)
+		{
+			fputs("Warning: GL debug output is not supported, GL errors will not be reported\n", stderr);
+			OpenGL::errormode = OFF;
+		}
+
+		return;
+	}
+
+	if (OpenGL::errormode == ASYNC)
+	{
+		glDebugMessageCallback(DebugCallback, NULL);
+		glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		glEnable(GL_DEBUG_OUTPUT);
+	}
+	else
+	{
+		glDisable(GL_DEBUG_OUTPUT);
+	}
+}
+
+void APIENTRY OpenGL::DebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, GLvoid *userparam)
+{
+	// Notifications about buffer placement etc. are of no interest
+	if (type != GL_DEBUG_TYPE_ERROR && severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+		return;
+
+	fprintf(stderr, "OpenGL %s (0x%x): %.*s\n", type == GL_DEBUG_TYPE_ERROR ? "error" : "message", id, (int)length, message);
+}
+
 void OpenGL::CheckError(const char *file, int line)
 {
+	if (OpenGL::errormode != STRICT)
+		return;
+
 	GLenum err;
 
 	for (err = glGetError(); err != GL_NO_ERROR; err = glGetError())
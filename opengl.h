@@ -5,15 +5,45 @@
 
 class OpenGL
 {
+public:
+	// How GL errors are reported:
+	// OFF     Not at all
+	// ASYNC   Through a KHR_debug message callback, without stalling the pipeline. Falls back
+	//         to OFF if the driver doesn't support it.
+	// STRICT  By polling glGetError at every CheckGLError. Slow, but reports the exact location.
+	enum ErrorMode
+	{
+		OFF,
+		ASYNC,
+		STRICT
+	};
+
+private:
 	virtual ~OpenGL() = 0;
 
 	static int initerror;
+	static ErrorMode errormode;
+
+	static void APIENTRY DebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, GLvoid *userparam);
 
 public:
 	static bool Init();
 
 	static bool VersionSupported(int major, int minor);
 
+	// ExtensionSupported returns true if the current context supports the given extension
+	static bool ExtensionSupported(const char *name);
+
+	// SetErrorMode selects the error mode for all contexts. It takes effect in a context when
+	// ApplyErrorMode is called with that context current.
+	static void SetErrorMode(ErrorMode mode);
+	static ErrorMode GetErrorMode();
+	static void ApplyErrorMode();
+
+	// ParseErrorMode converts "off", "async" or "strict" to an error mode. Returns false if
+	// the name is unknown.
+	static bool ParseErrorMode(const char *name, ErrorMode &mode);
+
 	static void CheckError(const char *file = "", int line = 0);
 };
 
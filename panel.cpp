@@ -1,10 +1,17 @@
 // Own stuff
 #include "panel.h"
+#include "profiler.h"
+#include "transferfunctionbaker.h"
 #include "transferfunctiondialog.h"
+#include "transferfunctionfile.h"
+#include "transferfunctionlibrary.h"
+#include "transferfunctionlistmodel.h"
 #include "volumemapper3d.h"
 
 // Standard library
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 // Qt
 #include <QPushButton>
@@ -13,10 +20,12 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QSlider>
-#include <QPainter>
-#include <QListWidget>
+#include <QComboBox>
+#include <QSpinBox>
+#include <QListView>
 #include <QSettings>
 #include <QApplication>
 #include <QCloseEvent>
@@ -37,12 +46,21 @@
 #include <vtkColorTransferFunction.h>
 #include <vtkCamera.h>
 
+// Frames rendered with each combination of settings during the allocation check
+static const int ALLOCATION_CHECK_PHASE = 30;
+
 Panel::Panel(QWidget *parent, Qt::WindowFlags f) : QWidget(parent, f)
 {
-	this->transferfunctions = NULL;
-	this->nrfunctions = 0;
+	this->library = std::make_shared<TransferFunctionLibrary>();
 	this->rotateperframe = 0.0;
 	this->blendperframe = 0.0;
+	this->classification = VolumeMapper3D::ClassificationMode::POINT;
+	this->fanout = 1;
+	this->passtiminglog = 0;
+	this->samplecachebudget = 0;
+	this->shadingmode = VolumeMapper3D::ShadingMode::EXACT;
+	this->allocationcheck = 0;
+	this->allocationcheckframe = 0;
 
 	this->setMinimumSize(250, 630);
 
@@ -63,10 +81,18 @@ Panel::Panel(QWidget *parent, Qt::WindowFlags f) : QWidget(parent, f)
 
 	panellayout->addWidget(new QLabel(tr("Transfer functions")));
 
-	this->listwidget = new QListWidget();
-	this->listwidget->setMinimumSize(256, 256);
-	this->listwidget->setIconSize(QSize(256, 32));
-	panellayout->addWidget(this->listwidget);
+	this->listmodel = new TransferFunctionListModel(this->library, this);
+	connect(this->listmodel, SIGNAL(rowsMoved(QModelIndex, int, int, QModelIndex, int)), this, SLOT(TransferFunctionChanged()));
+
+	// Uniform sizes let the view lay out rows without querying them, so only visible
+	// thumbnails are ever rendered
+	this->listview = new QListView();
+	this->listview->setMinimumSize(256, 256);
+	this->listview->setIconSize(QSize(TransferFunctionListModel::THUMBNAIL_WIDTH, TransferFunctionListModel::THUMBNAIL_HEIGHT));
+	this->listview->setUniformItemSizes(true);
+	this->listview->setDragDropMode(QAbstractItemView::InternalMove);
+	this->listview->setModel(this->listmodel);
+	panellayout->addWidget(this->listview);
 
 	QHBoxLayout *tfaddremovelayout = new QHBoxLayout();
 
@@ -113,10 +139,36 @@ Panel::Panel(QWidget *parent, Qt::WindowFlags f) : QWidget(parent, f)
 
 	panellayout->addSpacing(12);
 
+	panellayout->addWidget(new QLabel(tr("Classification")));
+
+	// Items in the order of VolumeMapper3D::ClassificationMode
+	QComboBox *classificationbox = new QComboBox();
+	classificationbox->addItem(tr("Point"));
+	classificationbox->addItem(tr("Pre-integrated"));
+	classificationbox->addItem(tr("Density and gradient magnitude (2D)"));
+	classificationbox->addItem(tr("Pre-classified (single transfer function)"));
+	connect(classificationbox, SIGNAL(currentIndexChanged(int)), this, SLOT(SetClassification(int)));
+	panellayout->addWidget(classificationbox);
+
+	panellayout->addSpacing(12);
+
+	panellayout->addWidget(new QLabel(tr("Side-by-side transfer functions")));
+
+	QSpinBox *fanoutbox = new QSpinBox();
+	fanoutbox->setRange(1, VolumeMapper3D::MAX_FAN_OUT);
+	connect(fanoutbox, SIGNAL(valueChanged(int)), this, SLOT(SetFanOut(int)));
+	panellayout->addWidget(fanoutbox);
+
+	panellayout->addSpacing(12);
+
 	QPushButton *renderbutton = new QPushButton(tr("Toggle fullscreen"));
 	connect(renderbutton, SIGNAL(clicked()), this, SLOT(ToggleFullscreen()));
 	panellayout->addWidget(renderbutton);
 
+	QPushButton *tracebutton = new QPushButton(tr("Save CPU trace..."));
+	connect(tracebutton, SIGNAL(clicked()), this, SLOT(SaveTrace()));
+	panellayout->addWidget(tracebutton);
+
 	panellayout->addStretch(1);
 	
 	this->renderwindow = new QmitkRenderWindow();
@@ -133,15 +185,47 @@ Panel::Panel(QWidget *parent, Qt::WindowFlags f) : QWidget(parent, f)
 
 Panel::~Panel()
 {
-	delete[] this->transferfunctions;
 }
 	
 void Panel::closeEvent(QCloseEvent *event)
 {
+	mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
+	if (node != NULL)
+	{
+		VolumeMapper3D *mapper = dynamic_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
+		if (mapper != NULL)
+		{
+			mapper->PrintShaderVariantTimes(stdout);
+			mapper->PrintGLStateStatistics(stdout);
+			mapper->PrintShadingDifference(stdout);
+		}
+	}
+
 	QApplication::closeAllWindows();
 	event->accept();
 }
 
+void Panel::SetPassTimingLogInterval(int frames)
+{
+	this->passtiminglog = frames;
+}
+
+void Panel::SetSampleCacheBudget(int megabytes)
+{
+	this->samplecachebudget = megabytes;
+}
+
+void Panel::SetShadingMode(int mode)
+{
+	this->shadingmode = mode;
+}
+
+void Panel::SetAllocationCheck(int frames)
+{
+	this->allocationcheck = frames;
+	this->allocationcheckframe = 0;
+}
+
 void Panel::SetDataStorage(mitk::DataStorage *storage)
 {
 	this->nodecombobox->SetDataStorage(storage);
@@ -162,6 +246,8 @@ void Panel::LoadDataNode()
 
 	try
 	{
+		PROFILE_SCOPE("LoadDataNode");
+
 		mitk::DataNodeFactory::Pointer reader = mitk::DataNodeFactory::New();
 		reader->SetFileName(local.constData());
 		reader->Update();
@@ -169,6 +255,13 @@ void Panel::LoadDataNode()
 
 		VolumeMapper3D::Pointer mapper = VolumeMapper3D::New();
 		mapper->SetDisplayMode(VolumeMapper3D::DisplayMode::DEMO);
+		mapper->SetClassificationMode((VolumeMapper3D::ClassificationMode)this->classification);
+		mapper->SetFanOut(this->fanout);
+		mapper->SetProgressiveRefinementEnabled(this->rotateperframe == 0.0 && this->blendperframe == 0.0);
+		mapper->SetFrameTimeBudget(16.0f);
+		mapper->SetPassTimingLogInterval(this->passtiminglog);
+		mapper->SetSampleCacheBudget(this->samplecachebudget);
+		mapper->SetShadingMode((VolumeMapper3D::ShadingMode)this->shadingmode);
 		node->SetMapper(mitk::BaseRenderer::Standard3D, mapper);
 
 		mitk::DataStorage::Pointer storage = this->nodecombobox->GetDataStorage();
@@ -228,94 +321,36 @@ void Panel::AddTransferFunction()
 
 	AddTransferFunctionData(property);
 
-	const uint8_t *data = this->transferfunctions;
-	data += 4096 * 4 * (this->nrfunctions - 1);
-	AddTransferFunctionItem(data);
-
 	TransferFunctionChanged();
 }
 	
 void Panel::AddTransferFunctionData(mitk::TransferFunctionProperty *property)
 {	
-	uint8_t *buffer = new uint8_t[4096 * 4 * (this->nrfunctions + 1)];
-	if (this->nrfunctions != 0)
-	{
-		memcpy(buffer, this->transferfunctions, 4096 * 4 * this->nrfunctions);
-	}
-	this->transferfunctions = buffer;
-
 	vtkColorTransferFunction *color = property->GetValue()->GetColorTransferFunction();
 	vtkPiecewiseFunction *opacity = property->GetValue()->GetScalarOpacityFunction();
+	vtkPiecewiseFunction *gradientopacity = property->GetValue()->GetGradientOpacityFunction();
 
-	buffer += 4096 * 4 * this->nrfunctions;
-	double rgba[4];
+	std::unique_ptr<unsigned char[]> row(new unsigned char[TransferFunctionLibrary::ROW_BYTES]);
+	TransferFunctionBaker::Bake(color, opacity, row.get());
 
-	for (int i = 0; i < 4096; i++)
-	{
-		color->GetColor(i - 1024, rgba);
-		rgba[3] = opacity->GetValue(i - 1024);
+	// Transfer functions with a fully opaque gradient opacity stay one-dimensional
+	std::unique_ptr<unsigned char[]> gradient(new unsigned char[TransferFunctionLibrary::GRADIENT_BYTES]);
+	if (!TransferFunctionBaker::BakeGradient(gradientopacity, gradient.get()))
+		gradient.reset();
 
-		rgba[0] *= rgba[3];
-		rgba[1] *= rgba[3];
-		rgba[2] *= rgba[3];
-
-		buffer[i * 4 + 0] = (uint8_t)(rgba[0] * 255.0);
-		buffer[i * 4 + 1] = (uint8_t)(rgba[1] * 255.0);
-		buffer[i * 4 + 2] = (uint8_t)(rgba[2] * 255.0);
-		buffer[i * 4 + 3] = (uint8_t)(rgba[3] * 255.0);
-	}
-	
-	this->nrfunctions++;
+	this->listmodel->Add(std::move(row), std::move(gradient));
 }
 	
-void Panel::AddTransferFunctionItem(const unsigned char *data)
-{
-	QImage tmp(4096, 512, QImage::Format_ARGB32_Premultiplied);
-	QPainter painter(&tmp);
-
-	for (int x = 0; x < 4096; x++)
-	{
-		int r = data[x * 4 + 0];
-		int g = data[x * 4 + 1];
-		int b = data[x * 4 + 2];
-		int a = data[x * 4 + 3];
-
-		if (a == 0)
-			continue;
-		
-		r = (255 * r) / a;
-		g = (255 * g) / a;
-		b = (255 * b) / a;
-
-		painter.setPen(QColor(r, g, b));
-		painter.drawLine(x, 511 - a * 2, x, 511);
-	}
-	painter.end();
-
-	QListWidgetItem *item = new QListWidgetItem();
-	item->setIcon(QIcon(QPixmap::fromImage(tmp.scaled(256, 32))));
-	item->setSizeHint(QSize(256, 32));
-
-	this->listwidget->addItem(item);
-}
-
 void Panel::DeleteTransferFunction()
 {
-	int index = this->listwidget->currentRow();
+	int index = this->listview->currentIndex().row();
 
-	if (index < 0 || index >= this->nrfunctions)
+	if (index < 0 || index >= this->library->GetCount())
 		return;
 
-	delete this->listwidget->takeItem(index);
-
-	uint8_t *buffer = new uint8_t[4096 * 4 * (this->nrfunctions - 1)];
-	memcpy(buffer, this->transferfunctions, 4 * 4096 * index);
-	memcpy(buffer + 4 * 4096 * index, this->transferfunctions + 4 * 4096 * (index + 1), 4 * 4096 * (this->nrfunctions - index - 1));
-
-	delete[] this->transferfunctions;
-	this->transferfunctions = buffer;
+	this->listmodel->Remove(index);
 
-	this->nrfunctions--;
+	TransferFunctionChanged();
 }
 
 void Panel::LoadTransferFunctions()
@@ -323,10 +358,42 @@ void Panel::LoadTransferFunctions()
 	QSettings settings;
 	QString lastpath(settings.value("Panel/LastTransferFunction").toString());
 
-	QString filename = QFileDialog::getOpenFileName(this, tr("Open"), lastpath, "PNG images (*.png)");
+	QString filename = QFileDialog::getOpenFileName(this, tr("Open"), lastpath, "Transfer functions (*.vtf *.png);;Transfer function libraries (*.vtf);;PNG images (*.png)");
 	if (filename.isEmpty())
 		return;
 
+	// Libraries are mapped and their rows used in place, PNG images have to be decoded
+	if (QFileInfo(filename).suffix().toLower() != "png")
+	{
+		std::vector<TransferFunctionFile::Entry> entries;
+		std::shared_ptr<const void> mapping;
+		QString error;
+
+		if (!TransferFunctionFile::Map(filename, entries, mapping, error))
+		{
+			QMessageBox mbox;
+			mbox.setText(tr("Couldn't load ") + filename);
+			mbox.setInformativeText(error);
+			mbox.setIcon(QMessageBox::Warning);
+			mbox.exec();
+			return;
+		}
+
+		this->listmodel->Clear();
+		this->listmodel->Append(entries, mapping);
+	}
+	else if (!LoadTransferFunctionImage(filename))
+		return;
+
+	settings.setValue("Panel/LastTransferFunction", filename);
+
+	TransferFunctionChanged();
+
+	this->refreshtimer->start(33);
+}
+
+bool Panel::LoadTransferFunctionImage(const QString &filename)
+{
 	QImage image;
 	if (!image.load(filename))
 	{
@@ -335,7 +402,7 @@ void Panel::LoadTransferFunctions()
 		mbox.setInformativeText(tr("Either the resource is not accessible, or the file format is not understood by this application."));
 		mbox.setIcon(QMessageBox::Warning);
 		mbox.exec();
-		return;
+		return false;
 	}
 
 	if (image.width() != 4096)
@@ -345,51 +412,86 @@ void Panel::LoadTransferFunctions()
 		mbox.setInformativeText(tr("Transfer function images are expected to be exactly 4096 pixels wide"));
 		mbox.setIcon(QMessageBox::Warning);
 		mbox.exec();
-		return;
+		return false;
 	}
 
-	this->nrfunctions = 0;
-	delete[] this->transferfunctions;
-	this->transferfunctions = NULL;
-	this->listwidget->clear();
-
 	if (image.format() != QImage::Format_ARGB32_Premultiplied)
 		image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
 
-	this->transferfunctions = new uint8_t[4096 * 4 * image.height()];
-	memcpy(this->transferfunctions, image.bits(), 4096 * 4 * image.height());
+	this->listmodel->Clear();
+	this->listmodel->Append(image.constBits(), image.height(), image.bytesPerLine());
+
+	return true;
+}
+
+void Panel::SaveTransferFunctions()
+{
+	if (this->library->GetCount() < 1)
+		return;
+	
+	QSettings settings;
+	QString lastpath(settings.value("Panel/LastTransferFunction").toString());
+
+	QString filename = QFileDialog::getSaveFileName(this, tr("Save as"), lastpath, "Transfer function libraries (*.vtf);;PNG images (*.png)");
+
+	if (filename.isEmpty())
+		return;
 
-	this->nrfunctions = image.height();
+	if (QFileInfo(filename).suffix().isEmpty())
+		filename += ".vtf";
 
-	for (int i = 0; i < this->nrfunctions; i++)
+	if (QFileInfo(filename).suffix().toLower() != "png")
 	{
-		const uint8_t *data = this->transferfunctions + 4096 * 4 * i;
-		AddTransferFunctionItem(data);
+		QString error;
+
+		if (!TransferFunctionFile::Write(filename, *this->library, error))
+		{
+			QMessageBox mbox;
+			mbox.setText(tr("Couldn't write to ") + filename);
+			mbox.setInformativeText(error);
+			mbox.setIcon(QMessageBox::Warning);
+			mbox.exec();
+			return;
+		}
 	}
+	else if (!SaveTransferFunctionImage(filename))
+		return;
 
 	settings.setValue("Panel/LastTransferFunction", filename);
+}
 
-	TransferFunctionChanged();
+bool Panel::SaveTransferFunctionImage(const QString &filename)
+{
+	QImage image(4096, this->library->GetCount(), QImage::Format_ARGB32_Premultiplied);
 
-	this->refreshtimer->start(33);
+	for (int i = 0; i < image.height(); i++)
+		memcpy(image.scanLine(i), this->library->GetRow(i), TransferFunctionLibrary::ROW_BYTES);
+	
+	if (!image.save(filename))
+	{
+		QMessageBox mbox;
+		mbox.setText(tr("Couldn't write to ") + filename);
+		mbox.setIcon(QMessageBox::Warning);
+		mbox.exec();
+		return false;
+	}
+
+	return true;
 }
 
-void Panel::SaveTransferFunctions()
+void Panel::SaveTrace()
 {
-	if (this->nrfunctions < 1)
-		return;
-	
 	QSettings settings;
-	QString lastpath(settings.value("Panel/LastTransferFunction").toString());
+	QString lastpath(settings.value("Panel/LastTrace").toString());
 
-	QString filename = QFileDialog::getSaveFileName(this, tr("Save as"), lastpath, "PNG images (*.png)");
+	QString filename = QFileDialog::getSaveFileName(this, tr("Save CPU trace as"), lastpath, "Trace files (*.json)");
 
 	if (filename.isEmpty())
 		return;
 
-	QImage image(this->transferfunctions, 4096, this->nrfunctions, QImage::Format_ARGB32_Premultiplied);
-	
-	if (!image.save(filename))
+	QByteArray local = filename.toLocal8Bit();
+
+	if (!Profiler::Dump(local.constData()))
 	{
 		QMessageBox mbox;
 		mbox.setText(tr("Couldn't write to ") + filename);
@@ -398,19 +500,57 @@ void Panel::SaveTransferFunctions()
 		return;
 	}
 
-	settings.setValue("Panel/LastTransferFunction", filename);
+	settings.setValue("Panel/LastTrace", filename);
 }
 
 void Panel::SetRotationSpeed(int speed)
 {
 	double scaled = (double)speed / 100.0;
 	this->rotateperframe = 5.0 * scaled;
+
+	UpdateProgressiveRefinement();
 }
 
 void Panel::SetTransitionSpeed(int speed)
 {
 	double scaled = (double)speed / 100.0;
 	this->blendperframe = 0.01 * scaled;
+
+	UpdateProgressiveRefinement();
+}
+
+void Panel::SetClassification(int mode)
+{
+	this->classification = mode;
+
+	mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
+	if (node == NULL)
+		return;
+
+	VolumeMapper3D *mapper = dynamic_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
+	if (mapper == NULL)
+		return;
+
+	mapper->SetClassificationMode((VolumeMapper3D::ClassificationMode)mode);
+
+	mitk::RenderingManager::GetInstance()->RequestUpdateAll();
+}
+
+void Panel::SetFanOut(int count)
+{
+	this->fanout = count;
+
+	mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
+	if (node == NULL)
+		return;
+
+	VolumeMapper3D *mapper = dynamic_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
+	if (mapper == NULL)
+		return;
+
+	mapper->SetFanOut(count);
+
+	mitk::RenderingManager::GetInstance()->RequestUpdateAll();
 }
 
 void Panel::TransferFunctionChanged()
@@ -423,7 +563,7 @@ void Panel::TransferFunctionChanged()
 	if (mapper == NULL)
 		return;
 
-	mapper->SetTransferTexture(this->nrfunctions, this->transferfunctions);
+	mapper->SetTransferFunctionLibrary(this->library);
 
 	mitk::RenderingManager::GetInstance()->RequestUpdateAll();
 }
@@ -450,7 +590,7 @@ void Panel::AdvanceTransferFunctionIndex(double step)
 {
 	mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
 
-	if (node == NULL || step == 0.0 || this->nrfunctions < 2)
+	if (node == NULL || step == 0.0 || this->library->GetCount() < 2)
 		return;
 
 	VolumeMapper3D *mapper = static_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
@@ -458,7 +598,7 @@ void Panel::AdvanceTransferFunctionIndex(double step)
 	double index = (double)mapper->GetTransferFunctionIndex();
 	index += step;
 
-	if (index >= (double)this->nrfunctions)
+	if (index >= (double)this->library->GetCount())
 	{
 		index = index - floor(index);
 	}
@@ -466,14 +606,92 @@ void Panel::AdvanceTransferFunctionIndex(double step)
 	mapper->SetTransferFunctionIndex((float)index);
 }
 
+void Panel::UpdateProgressiveRefinement()
+{
+	mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
+	if (node == NULL)
+		return;
+
+	VolumeMapper3D *mapper = dynamic_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
+	if (mapper == NULL)
+		return;
+
+	// Accumulating frames only pays off while nothing is animated
+	mapper->SetProgressiveRefinementEnabled(this->rotateperframe == 0.0 && this->blendperframe == 0.0);
+
+	mitk::RenderingManager::GetInstance()->RequestUpdateAll();
+}
+
+void Panel::StepAllocationCheck()
+{
+	mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
+	if (node == NULL)
+		return;
+
+	VolumeMapper3D *mapper = dynamic_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
+	if (mapper == NULL)
+		return;
+
+	if (this->allocationcheckframe >= this->allocationcheck)
+	{
+		// Any allocation in a checked frame has aborted the program already
+		const int checked = mapper->GetAllocationCheckFrames();
+		printf("Allocation check: %d of %d frames checked without heap allocations\n", checked, this->allocationcheckframe);
+
+		if (checked == 0)
+			fputs("Error: No frame was checked, allocations are only counted with COUNT_ALLOCATIONS\n", stderr);
+
+		this->allocationcheck = 0;
+		QApplication::exit(checked > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+		return;
+	}
+
+	const int phase = this->allocationcheckframe / ALLOCATION_CHECK_PHASE;
+	const bool moving = (phase / 8) % 2 == 1;
+
+	// Each phase switches to another shader variant, whose GPU times and resources only show
+	// up in the frames after the switch
+	if (this->allocationcheckframe % ALLOCATION_CHECK_PHASE == 0)
+	{
+		SetClassification(phase % 4);
+		SetFanOut((phase / 4) % 2 + 1);
+		mapper->SetProgressiveRefinementEnabled(!moving);
+	}
+
+	if (moving)
+		RotateCamera(1.0);
+
+	this->allocationcheckframe++;
+}
+
 void Panel::Refresh()
 {
-	if (this->nrfunctions < 1)
+	if (this->library->GetCount() < 1)
 	{
 		this->refreshtimer->stop();
 		return;
 	}
 
+	if (this->allocationcheck > 0)
+	{
+		StepAllocationCheck();
+		mitk::RenderingManager::GetInstance()->RequestUpdateAll();
+		return;
+	}
+
+	if (this->rotateperframe == 0.0 && this->blendperframe == 0.0)
+	{
+		// Static scene: Keep rendering only until progressive refinement has converged.
+		// Interaction triggers updates on its own and starts over.
+		mitk::DataNode *node = this->nodecombobox->GetSelectedNode();
+		if (node == NULL)
+			return;
+
+		VolumeMapper3D *mapper = dynamic_cast<VolumeMapper3D*>(node->GetMapper(mitk::BaseRenderer::Standard3D));
+		if (mapper == NULL || mapper->IsConverged())
+			return;
+	}
+
 	RotateCamera(this->rotateperframe);
 	AdvanceTransferFunctionIndex(this->blendperframe);
 
@@ -3,13 +3,18 @@
 
 #include <QWidget>
 
-class QListWidget;
+#include <memory>
+
+class QListView;
 class QTimer;
 
 class QmitkDataStorageComboBox;
 class QmitkRenderWindow;
 class QSlider;
 
+class TransferFunctionLibrary;
+class TransferFunctionListModel;
+
 namespace mitk
 {
 	class DataStorage;
@@ -21,22 +26,43 @@ class Panel : public QWidget
 	Q_OBJECT
 
 	QmitkDataStorageComboBox *nodecombobox;
-	QListWidget *listwidget;
+	QListView *listview;
 	QmitkRenderWindow *renderwindow;
 
 	QTimer *refreshtimer;
 
-	unsigned char *transferfunctions;
-	int nrfunctions;
+	// Shared with the mappers of all loaded volumes
+	std::shared_ptr<TransferFunctionLibrary> library;
+	TransferFunctionListModel *listmodel;
 
 	double rotateperframe;
 	double blendperframe;
 
+	// VolumeMapper3D::ClassificationMode of loaded volumes
+	int classification;
+
+	// Number of transfer functions shown side by side
+	int fanout;
+	int passtiminglog;
+	int samplecachebudget;
+
+	// VolumeMapper3D::ShadingMode of loaded volumes
+	int shadingmode;
+
+	// Length of the allocation check in frames, 0 if not running, and the frames rendered so far
+	int allocationcheck;
+	int allocationcheckframe;
+
 	void AddTransferFunctionData(mitk::TransferFunctionProperty *property);
-	void AddTransferFunctionItem(const unsigned char *data);
+
+	// PNG import and export, one transfer function per image row
+	bool LoadTransferFunctionImage(const QString &filename);
+	bool SaveTransferFunctionImage(const QString &filename);
 
 	void RotateCamera(double angle);
 	void AdvanceTransferFunctionIndex(double step);
+	void UpdateProgressiveRefinement();
+	void StepAllocationCheck();
 
 protected:
 	void closeEvent(QCloseEvent *event);
@@ -48,8 +74,11 @@ protected slots:
 	void DeleteTransferFunction();
 	void LoadTransferFunctions();
 	void SaveTransferFunctions();
+	void SaveTrace();
 	void SetRotationSpeed(int speed);
 	void SetTransitionSpeed(int speed);
+	void SetClassification(int mode);
+	void SetFanOut(int count);
 	void TransferFunctionChanged();
 	void Refresh();
 
@@ -57,6 +86,22 @@ public:
 	Panel(QWidget *parent = 0, Qt::WindowFlags f = 0);
 	~Panel();
 
+	// Interval in frames for logging GPU pass timings of loaded volumes, 0 disables logging
+	void SetPassTimingLogInterval(int frames);
+
+	// Memory for the sample cache of loaded volumes in megabytes. 0, the default, disables the
+	// cache.
+	void SetSampleCacheBudget(int megabytes);
+
+	// VolumeMapper3D::ShadingMode of loaded volumes, exact shading by default
+	void SetShadingMode(int mode);
+
+	// SetAllocationCheck makes the panel cycle through classification modes, side-by-side views,
+	// camera motion and progressive refinement for the given number of frames once a volume and
+	// transfer functions are loaded, and quit afterwards. The exit status is non-zero if no
+	// frame could be checked.
+	void SetAllocationCheck(int frames);
+
 public slots:
 	void SetDataStorage(mitk::DataStorage *storage);
 };
@@ -0,0 +1,140 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// WorkerPool keeps one thread per additional hardware thread alive for the whole run, so
+// ParallelFor doesn't create and join threads on every call. Only one loop runs on the pool
+// at a time.
+class WorkerPool
+{
+	std::vector<std::thread> threads;
+
+	// Held by the caller whose loop is running on the pool
+	std::mutex owner;
+
+	// Guards the job below
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::condition_variable done;
+
+	const std::function<void(int)> *body;
+	int count;
+	std::atomic<int> next;
+
+	// Incremented for every job, workers which have seen it decrement active when they are done
+	unsigned int generation;
+	int active;
+	bool quit;
+
+	// seen is the generation at the time the thread was created. Reading it here instead would
+	// skip a job started before the thread first takes the lock, and the job would never finish.
+	void Run(unsigned int seen)
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+
+		for (;;)
+		{
+			this->wakeup.wait(lock, [&] { return this->quit || this->generation != seen; });
+
+			if (this->quit)
+				return;
+
+			seen = this->generation;
+
+			const std::function<void(int)> &job = *this->body;
+			const int n = this->count;
+
+			lock.unlock();
+			Work(job, n);
+			lock.lock();
+
+			if (--this->active == 0)
+				this->done.notify_one();
+		}
+	}
+
+	void Work(const std::function<void(int)> &job, int n)
+	{
+		// Indices are handed out one at a time, so threads which finish early simply pick up
+		// more work instead of waiting for a statically assigned range.
+		for (int i = this->next++; i < n; i = this->next++)
+			job(i);
+	}
+
+public:
+	WorkerPool() : body(NULL), count(0), next(0), generation(0), active(0), quit(false)
+	{
+		const int nthreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+		for (int i = 0; i < nthreads - 1; i++)
+			this->threads.push_back(std::thread(&WorkerPool::Run, this, this->generation));
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->quit = true;
+			this->wakeup.notify_all();
+		}
+
+		for (size_t i = 0; i < this->threads.size(); i++)
+			this->threads[i].join();
+	}
+
+	// For returns false without calling body if the pool is busy with another loop
+	bool For(int count, const std::function<void(int)> &body)
+	{
+		std::unique_lock<std::mutex> own(this->owner, std::try_to_lock);
+
+		if (!own.owns_lock())
+			return false;
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+
+		this->body = &body;
+		this->count = count;
+		this->next = 0;
+		this->active = (int)this->threads.size();
+		this->generation++;
+		this->wakeup.notify_all();
+
+		lock.unlock();
+		Work(body, count);
+		lock.lock();
+
+		this->done.wait(lock, [this] { return this->active == 0; });
+		return true;
+	}
+
+	int GetThreadCount()
+	{
+		return (int)this->threads.size() + 1;
+	}
+};
+
+}
+
+void ParallelFor(int count, const std::function<void(int)> &body)
+{
+	if (count < 1)
+		return;
+
+	static WorkerPool pool;
+
+	if (count == 1 || pool.GetThreadCount() == 1 || !pool.For(count, body))
+	{
+		// Loops started while the pool is busy, e.g. from within another loop or from a
+		// background thread, run on the calling thread
+		for (int i = 0; i < count; i++)
+			body(i);
+	}
+}
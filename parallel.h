@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+// ParallelFor calls body(i) once for every i in [0, count) and distributes the calls over all
+// available hardware threads, using a pool of threads created on first use. It returns after
+// the last call has completed. The body must be safe to execute concurrently for different
+// indices. While the pool runs another loop, the calls are made on the calling thread.
+void ParallelFor(int count, const std::function<void(int)> &body);
+
+#endif // PARALLEL_H
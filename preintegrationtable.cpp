@@ -0,0 +1,84 @@
+#include "preintegrationtable.h"
+#include "hash.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Number of table lines integrated by one parallel work item
+static const int LINES_PER_TASK = 32;
+
+PreIntegrationTable::PreIntegrationTable(int size) : TransferTable(size, size, LINES_PER_TASK), size(size), prefix((ROW_LENGTH + 1) * 4, 0)
+{
+}
+
+void PreIntegrationTable::ComputePrefixSums(const unsigned char *row)
+{
+	// The sums of 4096 8-bit values are small enough to be represented exactly
+	uint32_t *prefix = this->prefix.data();
+
+	for (int c = 0; c < 4; c++)
+		prefix[c] = 0;
+
+	for (int i = 0; i < ROW_LENGTH; i++)
+	{
+		for (int c = 0; c < 4; c++)
+			prefix[(i + 1) * 4 + c] = prefix[i * 4 + c] + row[i * 4 + c];
+	}
+}
+
+void PreIntegrationTable::BuildLines(const unsigned char *row, int first, int last, unsigned char *table)
+{
+	const uint32_t *prefix = this->prefix.data();
+
+	const double scale = (double)ROW_LENGTH / (double)this->size;
+
+	for (int f = first; f < last; f++)
+	{
+		// Position of the front sample in transfer function entries
+		const double xf = ((double)f + 0.5) * scale;
+		const int kf = std::min((int)xf, ROW_LENGTH - 1);
+
+		for (int b = 0; b < this->size; b++)
+		{
+			const double xb = ((double)b + 0.5) * scale;
+			const int kb = std::min((int)xb, ROW_LENGTH - 1);
+
+			unsigned char *out = table + (f * this->size + b) * 4;
+
+			if (f == b)
+			{
+				// Zero length segment: Same as a point sample
+				memcpy(out, row + kf * 4, 4);
+				continue;
+			}
+
+			for (int c = 0; c < 4; c++)
+			{
+				const double pf = prefix[kf * 4 + c] + (xf - kf) * row[kf * 4 + c];
+				const double pb = prefix[kb * 4 + c] + (xb - kb) * row[kb * 4 + c];
+				const double avg = (pb - pf) / (xb - xf);
+
+				out[c] = (unsigned char)std::min(255.0, floor(avg + 0.5));
+			}
+		}
+	}
+}
+
+bool PreIntegrationTable::UpdateRow(int row, const unsigned char *data, const unsigned char *gradient)
+{
+	Hash hash;
+	hash.Add(data, ROW_LENGTH * 4);
+
+	if (IsBuilt(row, hash.Get()))
+		return false;
+
+	// Shared by all work items of the row
+	ComputePrefixSums(data);
+
+	return BuildRow(row, hash.Get(), [&](int first, int last, unsigned char *table)
+	{
+		BuildLines(data, first, last, table);
+	});
+}
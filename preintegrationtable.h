@@ -0,0 +1,37 @@
+#ifndef PRE_INTEGRATION_TABLE_H
+#define PRE_INTEGRATION_TABLE_H
+
+#include "transfertable.h"
+
+#include <stdint.h>
+#include <vector>
+
+// PreIntegrationTable holds one pre-integrated lookup table per transfer function. Each table
+// is indexed by the densities at the front and back of a ray segment and stores the average
+// premultiplied RGBA value of the transfer function between both densities. Tables are built
+// from the 4096-entry rows used by Panel and VolumeMapper3D.
+class PreIntegrationTable : public TransferTable
+{
+	int size;
+
+	// Prefix sums of the RGBA channels of the row being built, with ROW_LENGTH + 1 entries
+	std::vector<uint32_t> prefix;
+
+	void ComputePrefixSums(const unsigned char *row);
+
+	// BuildLines integrates the table lines [first, last) of a single transfer function row,
+	// whose prefix sums have been computed
+	void BuildLines(const unsigned char *row, int first, int last, unsigned char *table);
+
+public:
+	// Number of entries in a single transfer function row
+	static const int ROW_LENGTH = 4096;
+
+	PreIntegrationTable(int size = 256);
+
+	// The table is indexed by density only, so the gradient row is ignored. The front density
+	// selects the line, the back density the column of the table.
+	bool UpdateRow(int row, const unsigned char *data, const unsigned char *gradient);
+};
+
+#endif // PRE_INTEGRATION_TABLE_H
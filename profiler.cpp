@@ -0,0 +1,176 @@
+#include "profiler.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Number of events kept per thread
+static const int BUFFER_SIZE = 16384;
+
+namespace
+{
+	struct ProfileEvent
+	{
+		const char *name;
+		int64_t start;
+		int64_t duration;
+	};
+
+	// A slot of the ring. sequence is the index of the event it holds plus 1, or 0 while the
+	// owner writes to it, so a reader can tell whether its copy is complete and current.
+	struct ProfileSlot
+	{
+		std::atomic<uint64_t> sequence;
+		std::atomic<const char*> name;
+		std::atomic<int64_t> start;
+		std::atomic<int64_t> duration;
+
+		ProfileSlot() : sequence(0), name(NULL), start(0), duration(0)
+		{
+		}
+	};
+
+	// Ring buffer of a single thread. Only the owning thread writes, readers check the
+	// sequence of each slot. Buffers of finished threads are reused, their events are kept
+	// until they are overwritten.
+	struct ProfileBuffer
+	{
+		ProfileSlot slots[BUFFER_SIZE];
+		std::atomic<uint64_t> written;
+		std::atomic<bool> inuse;
+		int id;
+
+		ProfileBuffer(int id) : written(0), inuse(true), id(id)
+		{
+		}
+	};
+
+	std::mutex buffersmutex;
+	std::vector<ProfileBuffer*> buffers;
+
+	ProfileBuffer *AcquireBuffer()
+	{
+		std::lock_guard<std::mutex> lock(buffersmutex);
+
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			bool expected = false;
+			if (buffers[i]->inuse.compare_exchange_strong(expected, true))
+				return buffers[i];
+		}
+
+		ProfileBuffer *buffer = new ProfileBuffer((int)buffers.size() + 1);
+		buffers.push_back(buffer);
+		return buffer;
+	}
+
+	// Returns the buffer to the pool when its thread ends
+	struct ThreadBuffer
+	{
+		ProfileBuffer *buffer;
+
+		ThreadBuffer() : buffer(AcquireBuffer())
+		{
+		}
+
+		~ThreadBuffer()
+		{
+			this->buffer->inuse = false;
+		}
+	};
+
+	thread_local ThreadBuffer threadbuffer;
+}
+
+int64_t Profiler::Now()
+{
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::Record(const char *name, int64_t start, int64_t end)
+{
+	ProfileBuffer *buffer = threadbuffer.buffer;
+
+	const uint64_t index = buffer->written.load(std::memory_order_relaxed);
+
+	ProfileSlot &slot = buffer->slots[index % BUFFER_SIZE];
+
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.start.store(start, std::memory_order_relaxed);
+	slot.duration.store(end - start, std::memory_order_relaxed);
+
+	slot.sequence.store(index + 1, std::memory_order_release);
+	buffer->written.store(index + 1, std::memory_order_release);
+}
+
+bool Profiler::Dump(const char *path)
+{
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL)
+		return false;
+
+	fputs("{\"traceEvents\":[\n", file);
+
+	std::vector<ProfileEvent> events;
+	events.reserve(BUFFER_SIZE);
+	bool first = true;
+
+	std::lock_guard<std::mutex> lock(buffersmutex);
+
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		ProfileBuffer *buffer = buffers[i];
+
+		// The oldest event still in the ring, without the slot the owner writes next
+		const uint64_t end = buffer->written.load(std::memory_order_acquire);
+		const uint64_t begin = end > (uint64_t)BUFFER_SIZE ? end - BUFFER_SIZE + 1 : 0;
+
+		events.clear();
+
+		for (uint64_t j = begin; j < end; j++)
+		{
+			const ProfileSlot &slot = buffer->slots[j % BUFFER_SIZE];
+
+			const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+			ProfileEvent event;
+			event.name = slot.name.load(std::memory_order_relaxed);
+			event.start = slot.start.load(std::memory_order_relaxed);
+			event.duration = slot.duration.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			// Skip events which the owner has overwritten or started to overwrite meanwhile
+			if (sequence != j + 1 || slot.sequence.load(std::memory_order_relaxed) != sequence)
+				continue;
+
+			events.push_back(event);
+		}
+
+		for (size_t j = 0; j < events.size(); j++)
+		{
+			const ProfileEvent &event = events[j];
+
+			// Names are string literals of this program and need no escaping
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d}",
+				first ? "" : ",\n", event.name, (long long)event.start, (long long)event.duration, buffer->id);
+
+			first = false;
+		}
+	}
+
+	fputs("\n]}\n", file);
+
+	const bool ok = ferror(file) == 0;
+	fclose(file);
+
+	return ok;
+}
@@ -0,0 +1,50 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+// Profiler records CPU time spans of named stages. Each thread writes into its own ring
+// buffer of the most recent events without locking, so recording is cheap enough to stay
+// enabled all the time. Dump writes all buffered events in the Chrome trace event format,
+// which can be opened with chrome://tracing or the Perfetto UI.
+class Profiler
+{
+	virtual ~Profiler() = 0;
+
+public:
+	// Now returns microseconds since the first call.
+	static int64_t Now();
+
+	// Record adds an event to the buffer of the calling thread. The name must remain valid
+	// until the program ends, i.e. it should be a string literal.
+	static void Record(const char *name, int64_t start, int64_t end);
+
+	// Dump writes the events of all threads to a JSON file. Events recorded while dumping
+	// may be missing. Returns false if the file can't be written.
+	static bool Dump(const char *path);
+};
+
+// ProfileScope records the time between its construction and destruction.
+class ProfileScope
+{
+	const char *name;
+	int64_t start;
+
+public:
+	explicit ProfileScope(const char *name) : name(name), start(Profiler::Now())
+	{
+	}
+
+	~ProfileScope()
+	{
+		Profiler::Record(this->name, this->start, Profiler::Now());
+	}
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Profiles the rest of the enclosing scope
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profilescope, __LINE__)(name)
+
+#endif // PROFILER_H
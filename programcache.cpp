@@ -0,0 +1,154 @@
+#include "programcache.h"
+#include "hash.h"
+#include "opengl.h"
+#include "shaderprogram.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QTemporaryFile>
+
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+// Header of a cache file, followed by the program binary
+struct CacheHeader
+{
+	char magic[8];
+	uint64_t key;
+	uint32_t format;
+	uint32_t size;
+};
+
+static const char CACHE_MAGIC[8] = { 'V', 'R', 'D', 'P', 'R', 'O', 'G', '1' };
+
+static uint64_t GetKey(const char *vsrc, const char *fsrc, const char *defines)
+{
+	Hash hash;
+
+	hash.AddString(vsrc);
+	hash.AddString(fsrc);
+	hash.AddString(defines);
+	hash.AddString((const char*)glGetString(GL_VENDOR));
+	hash.AddString((const char*)glGetString(GL_RENDERER));
+	hash.AddString((const char*)glGetString(GL_VERSION));
+
+	return hash.Get();
+}
+
+static QString GetPath(uint64_t key)
+{
+#if QT_VERSION >= 0x050000
+	QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+	QString dir = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+	dir += "/programs";
+
+	char name[32];
+	sprintf(name, "/%016llx.bin", (unsigned long long)key);
+
+	return dir + name;
+}
+
+bool ProgramCache::Load(ShaderProgram *program, const char *vsrc, const char *fsrc, const char *defines)
+{
+	if (!ShaderProgram::BinarySupported())
+		return false;
+
+	const uint64_t key = GetKey(vsrc, fsrc, defines);
+
+	QFile file(GetPath(key));
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	CacheHeader header;
+	if (file.read((char*)&header, sizeof(header)) != sizeof(header))
+		return false;
+
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.key != key)
+		return false;
+
+	// A size beyond the end of the file means the entry is corrupt, so it is removed like
+	// a rejected one
+	bool ok = header.size <= (uint64_t)(file.size() - (qint64)sizeof(header));
+
+	if (ok)
+	{
+		char *data = new char[header.size];
+
+		// A failed read is just a miss, the entry may well be valid
+		if (file.read(data, header.size) != (qint64)header.size)
+		{
+			delete[] data;
+			return false;
+		}
+
+		ok = program->LoadBinary(header.format, data, (int)header.size);
+
+		delete[] data;
+	}
+
+	// Remove entries the driver no longer accepts. They are written again after the
+	// program has been built from source.
+	if (!ok)
+	{
+		file.close();
+		file.remove();
+	}
+
+	return ok;
+}
+
+void ProgramCache::Store(ShaderProgram *program, const char *vsrc, const char *fsrc, const char *defines)
+{
+	unsigned int format;
+	int size;
+
+	char *data = program->GetBinary(&format, &size);
+	if (data == NULL)
+		return;
+
+	const uint64_t key = GetKey(vsrc, fsrc, defines);
+	const QString path = GetPath(key);
+
+	QDir().mkpath(QFileInfo(path).absolutePath());
+
+	CacheHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.key = key;
+	header.format = format;
+	header.size = (uint32_t)size;
+
+	// Entries are written to a temporary file in the same directory and renamed into place, so
+	// other instances never see a partially written entry
+	QTemporaryFile file(path + ".XXXXXX");
+	file.setAutoRemove(false);
+
+	if (file.open())
+	{
+		bool ok = file.write((const char*)&header, sizeof(header)) == sizeof(header);
+		ok = ok && file.write(data, size) == size;
+		ok = ok && file.flush();
+
+		file.close();
+
+		if (!ok)
+			fprintf(stderr, "Can't write program cache entry %s\n", path.toLocal8Bit().constData());
+
+		// Renaming fails if another instance has stored the same entry in the meantime,
+		// which has the same contents
+		if (!ok || !file.rename(path))
+			file.remove();
+	}
+
+	delete[] data;
+}
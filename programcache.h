@@ -0,0 +1,23 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+class ShaderProgram;
+
+// ProgramCache stores linked shader programs on disk, so they can be restored on the next
+// start without compiling them again. Entries are keyed by the shader sources and the
+// vendor, renderer and version strings of the current GL context. A driver update
+// therefore simply results in cache misses.
+class ProgramCache
+{
+	virtual ~ProgramCache() = 0;
+
+public:
+	// Load restores a program from the cache. Returns false if there is no entry for the given
+	// sources or if the driver rejects the stored binary.
+	static bool Load(ShaderProgram *program, const char *vsrc, const char *fsrc, const char *defines);
+
+	// Store writes a successfully built program to the cache.
+	static void Store(ShaderProgram *program, const char *vsrc, const char *fsrc, const char *defines);
+};
+
+#endif // PROGRAM_CACHE_H
@@ -0,0 +1,176 @@
+#include "rendertargetpool.h"
+#include "glstatecache.h"
+#include "opengl.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+// Targets are allocated in multiples of this size
+static const int BUCKET_SIZE = 256;
+
+// Time in ms the window must have fit into a smaller bucket before the targets shrink
+static const qint64 SHRINK_DELAY = 2000;
+
+RenderTargetPool::RenderTargetPool(GLStateCache *glstate, int count) : glstate(glstate), reallocations(0)
+{
+	Target empty = { 0, 0 };
+	this->targets.assign(count, empty);
+
+	this->size[0] = this->size[1] = 0;
+	this->windowsize[0] = this->windowsize[1] = 0;
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+}
+
+void RenderTargetPool::Destroy()
+{
+	for (size_t i = 0; i < this->targets.size(); i++)
+	{
+		glDeleteFramebuffers(1, &this->targets[i].framebuffer);
+		glDeleteTextures(1, &this->targets[i].texture);
+
+		this->targets[i].framebuffer = 0;
+		this->targets[i].texture = 0;
+	}
+}
+
+int RenderTargetPool::GetBucketSize(int size)
+{
+	return ((size + BUCKET_SIZE - 1) / BUCKET_SIZE) * BUCKET_SIZE;
+}
+
+bool RenderTargetPool::Resize(int w, int h)
+{
+	this->windowsize[0] = w;
+	this->windowsize[1] = h;
+
+	const int bucketw = GetBucketSize(w);
+	const int bucketh = GetBucketSize(h);
+
+	bool reallocate = false;
+
+	if (w > this->size[0] || h > this->size[1])
+	{
+		// Grow at once, the window doesn't fit anymore. Neither dimension shrinks here, so
+		// resizing back and forth doesn't alternate between buckets.
+		this->size[0] = std::max(this->size[0], bucketw);
+		this->size[1] = std::max(this->size[1], bucketh);
+		this->shrinktimer.invalidate();
+		reallocate = true;
+	}
+	else if (bucketw < this->size[0] || bucketh < this->size[1])
+	{
+		if (!this->shrinktimer.isValid())
+		{
+			this->shrinktimer.start();
+		}
+		else if (this->shrinktimer.elapsed() >= SHRINK_DELAY)
+		{
+			this->size[0] = bucketw;
+			this->size[1] = bucketh;
+			this->shrinktimer.invalidate();
+			reallocate = true;
+		}
+	}
+	else
+	{
+		this->shrinktimer.invalidate();
+	}
+
+	if (!reallocate)
+		return false;
+
+	bool allocated = false;
+
+	for (size_t i = 0; i < this->targets.size(); i++)
+	{
+		if (this->targets[i].texture == 0)
+			continue;
+
+		Allocate(this->targets[i]);
+		allocated = true;
+	}
+
+	if (allocated)
+		this->reallocations++;
+
+	return allocated;
+}
+
+void RenderTargetPool::Acquire(int index)
+{
+	Target &target = this->targets[index];
+
+	if (target.framebuffer != 0 && target.texture != 0)
+		return;
+
+	// All GL objects are owned by the pool, so a name of 0 means the object has not been
+	// created yet
+	if (target.framebuffer == 0)
+	{
+		glGenFramebuffers(1, &target.framebuffer);
+		CheckGLError();
+	}
+
+	if (target.texture == 0)
+	{
+		glGenTextures(1, &target.texture);
+		CheckGLError();
+	}
+
+	Allocate(target);
+}
+
+void RenderTargetPool::Allocate(Target &target)
+{
+	this->glstate->BindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+
+	this->glstate->BindTexture(GL_TEXTURE_2D, target.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, this->size[0], this->size[1], 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	CheckGLError();
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+	CheckGLError();
+
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, "Warning: FBO status is 0x%x\n", status);
+}
+
+unsigned int RenderTargetPool::GetFramebuffer(int index)
+{
+	return this->targets[index].framebuffer;
+}
+
+unsigned int RenderTargetPool::GetTexture(int index)
+{
+	return this->targets[index].texture;
+}
+
+int RenderTargetPool::GetWidth()
+{
+	return this->size[0];
+}
+
+int RenderTargetPool::GetHeight()
+{
+	return this->size[1];
+}
+
+void RenderTargetPool::GetWindowScale(float scale[2])
+{
+	scale[0] = this->size[0] > 0 ? (float)this->windowsize[0] / (float)this->size[0] : 1.0f;
+	scale[1] = this->size[1] > 0 ? (float)this->windowsize[1] / (float)this->size[1] : 1.0f;
+}
+
+int RenderTargetPool::GetReallocations()
+{
+	return this->reallocations;
+}
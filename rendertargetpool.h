@@ -0,0 +1,67 @@
+#ifndef RENDER_TARGET_POOL_H
+#define RENDER_TARGET_POOL_H
+
+#include <QElapsedTimer>
+
+#include <vector>
+
+class GLStateCache;
+
+// RenderTargetPool owns a set of equally sized RGBA32F textures, each attached to its own
+// FBO. The textures are allocated in size buckets and may be larger than the window, which
+// renders into the lower left part of each one. They grow as soon as the window no longer
+// fits, but shrink only after it has been smaller for a while, so resizing a window doesn't
+// reallocate them on every frame. All methods need the GL context of the pool to be current.
+class RenderTargetPool
+{
+	struct Target
+	{
+		unsigned int framebuffer;
+		unsigned int texture;
+	};
+
+	GLStateCache *glstate;
+	std::vector<Target> targets;
+
+	// Allocated size of all targets and the window size passed to Resize
+	int size[2];
+	int windowsize[2];
+
+	// Runs while the window fits into a smaller bucket than the allocated one
+	QElapsedTimer shrinktimer;
+
+	int reallocations;
+
+	static int GetBucketSize(int size);
+
+	void Allocate(Target &target);
+
+public:
+	RenderTargetPool(GLStateCache *glstate, int count);
+	~RenderTargetPool();
+
+	// Destroy deletes all GL objects
+	void Destroy();
+
+	// Resize sets the window size. Returns true if the existing targets have been
+	// reallocated, which discards their contents.
+	bool Resize(int w, int h);
+
+	// Acquire creates a target at the current size, if it doesn't exist yet
+	void Acquire(int index);
+
+	unsigned int GetFramebuffer(int index);
+	unsigned int GetTexture(int index);
+
+	// Allocated size of the targets
+	int GetWidth();
+	int GetHeight();
+
+	// Part of the targets covered by the window, in texture coordinates
+	void GetWindowScale(float scale[2]);
+
+	// Number of times the targets have been reallocated after their creation
+	int GetReallocations();
+};
+
+#endif // RENDER_TARGET_POOL_H
@@ -0,0 +1,104 @@
+#include "resolutioncontroller.h"
+
+#include <algorithm>
+
+// Limits of the adjustable settings
+static const float MIN_SCALE = 0.25f;
+static const float MAX_STEP_FACTOR = 2.0f;
+
+// Factor applied to scale or step factor per adjustment
+static const float ADJUST_FACTOR = 1.25f;
+
+// Frame times above budget * OVER_BUDGET reduce quality, below budget * UNDER_BUDGET raise it
+static const float OVER_BUDGET = 1.1f;
+static const float UNDER_BUDGET = 0.7f;
+
+// Weight of a new measurement in the smoothed frame time
+static const float SMOOTHING = 0.25f;
+
+// Measurements are taken a few frames late, so ignore as many after each adjustment
+static const int COOLDOWN_FRAMES = 8;
+
+// Number of measurements to average before the first adjustment
+static const int MIN_SAMPLES = 4;
+
+ResolutionController::ResolutionController() : budget(16.0f)
+{
+	Reset();
+}
+
+void ResolutionController::SetBudget(float ms)
+{
+	this->budget = ms;
+}
+
+float ResolutionController::GetBudget()
+{
+	return this->budget;
+}
+
+void ResolutionController::Reset()
+{
+	this->scale = 1.0f;
+	this->stepfactor = 1.0f;
+	this->average = 0.0f;
+	this->samples = 0;
+	this->cooldown = 0;
+}
+
+bool ResolutionController::Update(float ms)
+{
+	if (this->cooldown > 0)
+	{
+		this->cooldown--;
+		return false;
+	}
+
+	if (this->samples == 0)
+		this->average = ms;
+	else
+		this->average += SMOOTHING * (ms - this->average);
+
+	if (++this->samples < MIN_SAMPLES)
+		return false;
+
+	const float oldscale = this->scale;
+	const float oldstepfactor = this->stepfactor;
+
+	if (this->average > this->budget * OVER_BUDGET)
+	{
+		// Resolution first: Each step saves more than a longer ray step, and reduced
+		// resolution frames are only shown while the view is in motion
+		if (this->scale > MIN_SCALE)
+			this->scale = std::max(this->scale / ADJUST_FACTOR, MIN_SCALE);
+		else
+			this->stepfactor = std::min(this->stepfactor * ADJUST_FACTOR, MAX_STEP_FACTOR);
+	}
+	else if (this->average < this->budget * UNDER_BUDGET)
+	{
+		// In reverse order
+		if (this->stepfactor > 1.0f)
+			this->stepfactor = std::max(this->stepfactor / ADJUST_FACTOR, 1.0f);
+		else
+			this->scale = std::min(this->scale * ADJUST_FACTOR, 1.0f);
+	}
+
+	if (this->scale == oldscale && this->stepfactor == oldstepfactor)
+		return false;
+
+	// Start over with the new settings
+	this->samples = 0;
+	this->cooldown = COOLDOWN_FRAMES;
+
+	return true;
+}
+
+float ResolutionController::GetScale()
+{
+	return this->scale;
+}
+
+float ResolutionController::GetStepFactor()
+{
+	return this->stepfactor;
+}
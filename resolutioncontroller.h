@@ -0,0 +1,39 @@
+#ifndef RESOLUTION_CONTROLLER_H
+#define RESOLUTION_CONTROLLER_H
+
+// ResolutionController adjusts render scale and ray step length so that measured frame
+// times stay close to a budget. Quality is only reduced when the smoothed frame time
+// exceeds the budget and only raised again when there is plenty of headroom, and every
+// adjustment is followed by a few frames without further changes. This keeps the image
+// from flickering between two settings.
+class ResolutionController
+{
+	float budget;
+	float scale;
+	float stepfactor;
+	float average;
+	int samples;
+	int cooldown;
+
+public:
+	ResolutionController();
+
+	// Target frame time in milliseconds
+	void SetBudget(float ms);
+	float GetBudget();
+
+	// Update feeds a measured frame time in milliseconds, taken with the current settings.
+	// Returns true if the settings have changed.
+	bool Update(float ms);
+
+	// Reset returns to full quality.
+	void Reset();
+
+	// Render scale in [1/4, 1]
+	float GetScale();
+
+	// Step length relative to the default step, in [1, 2]
+	float GetStepFactor();
+};
+
+#endif // RESOLUTION_CONTROLLER_H
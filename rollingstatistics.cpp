@@ -0,0 +1,66 @@
+#include "rollingstatistics.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+RollingStatistics::RollingStatistics(int capacity) : samples(capacity, 0.0f), sorted(capacity, 0.0f), next(0), count(0)
+{
+}
+
+void RollingStatistics::Add(float value)
+{
+	this->samples[this->next] = value;
+	this->next = (this->next + 1) % (int)this->samples.size();
+
+	if (this->count < (int)this->samples.size())
+		this->count++;
+}
+
+void RollingStatistics::Clear()
+{
+	this->next = 0;
+	this->count = 0;
+}
+
+int RollingStatistics::GetCount()
+{
+	return this->count;
+}
+
+float RollingStatistics::GetMin()
+{
+	if (this->count == 0)
+		return 0.0f;
+
+	return *std::min_element(this->samples.begin(), this->samples.begin() + this->count);
+}
+
+float RollingStatistics::GetAverage()
+{
+	if (this->count == 0)
+		return 0.0f;
+
+	double sum = 0.0;
+
+	for (int i = 0; i < this->count; i++)
+		sum += this->samples[i];
+
+	return (float)(sum / this->count);
+}
+
+float RollingStatistics::GetPercentile(float fraction)
+{
+	if (this->count == 0)
+		return 0.0f;
+
+	// Order does not matter for the other statistics, but the ring must stay intact
+	std::copy(this->samples.begin(), this->samples.begin() + this->count, this->sorted.begin());
+
+	int index = (int)ceilf(fraction * this->count) - 1;
+	index = std::min(std::max(index, 0), this->count - 1);
+
+	std::nth_element(this->sorted.begin(), this->sorted.begin() + index, this->sorted.begin() + this->count);
+
+	return this->sorted[index];
+}
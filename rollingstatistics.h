@@ -0,0 +1,30 @@
+#ifndef ROLLING_STATISTICS_H
+#define ROLLING_STATISTICS_H
+
+#include <vector>
+
+// RollingStatistics keeps the most recent samples of a measurement and computes minimum,
+// average and percentiles over them. Adding a sample never allocates memory.
+class RollingStatistics
+{
+	std::vector<float> samples;
+	std::vector<float> sorted;
+	int next;
+	int count;
+
+public:
+	RollingStatistics(int capacity = 256);
+
+	void Add(float value);
+	void Clear();
+
+	int GetCount();
+	float GetMin();
+	float GetAverage();
+
+	// GetPercentile returns the smallest sample which is greater than or equal to the given
+	// fraction (0 to 1) of all samples.
+	float GetPercentile(float fraction);
+};
+
+#endif // ROLLING_STATISTICS_H
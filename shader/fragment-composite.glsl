@@ -0,0 +1,15 @@
+#version 330 core
+
+// Offscreen image to be drawn to the screen
+uniform sampler2D image;
+
+// Texture coordinates
+in vec2 samplepos;
+
+// Final fragment color
+layout(location = 0) out vec4 out_color;
+
+void main()
+{
+	out_color = texture(image, samplepos);
+}
@@ -1,5 +1,26 @@
 #version 330 core
 
+// Optional features. VolumeMapper3D compiles one variant of this shader for each
+// combination it needs and passes the enabled features as #defines:
+// LIGHTING          Phong illumination, with the light source at the camera position
+// MODULATION        Opacity modulation by gradient magnitude and silhouettes (only the
+//                   latter with CLASSIFY_2D)
+// FORWARD_GRADIENT  Forward instead of central differences (4 instead of 6 fetches)
+// PREINTEGRATED     Classify ray segments using pre-integrated tables
+// CLASSIFY_2D       Classify samples by density and gradient magnitude using 2D tables
+// BLEND_TRANSFER    Interpolate between two pre-integrated or 2D tables
+// SKIP_EMPTY        Skip shading and compositing for fully transparent samples
+// JITTER            Offset the ray start by a per-pixel fraction of the step (progressive refinement)
+// FAN_OUT_2/3/4     Classify every sample with 2 to 4 transfer functions and write one
+//                   color output per transfer function
+// CAPTURE_SAMPLES   Write density and gradient of 8 consecutive samples of each ray to the
+//                   sample cache instead of compositing
+// CACHED_SAMPLES    Read the first samples of each ray from the sample cache
+// PRECLASSIFIED     Fetch premultiplied colors from a volume classified on the CPU, without
+//                   transfer function lookups, gradients or shading
+// SHADING_TABLE     Look up illumination and silhouette modulation by gradient direction in
+//                   a table built once per frame (with LIGHTING or MODULATION)
+
 // 3D texture containing normalized volume data
 uniform sampler3D volume;
 
@@ -7,28 +28,121 @@ uniform sampler3D volume;
 uniform sampler2D frontfaces;
 uniform sampler2D backfaces;
 
-// 2D texture containing transfer functions (1 per row)
-uniform sampler2D transfer;
-
-// Index of current transfer function
-uniform float transferindex = 0.0;
-
-// Camera position in world space
-uniform vec3 camerapos;
-
-// Inverted model matrix
-uniform mat4 invertedmodel;
+#ifdef PRECLASSIFIED
+// Premultiplied RGBA voxels, classified with the current transfer function
+uniform sampler3D classified;
+#elif defined(PREINTEGRATED)
+// Pre-integrated transfer functions (1 per layer), indexed by front and back density
+uniform sampler2DArray preintegration;
+
+// Layers of the current and the next transfer function. fract(transferindex) blends
+// between them.
+uniform vec2 layers;
+#elif defined(CLASSIFY_2D)
+// Two-dimensional transfer functions (1 per layer), indexed by density and gradient magnitude
+uniform sampler2DArray transfer2d;
+
+// Layers of the current and the next transfer function, as above
+uniform vec2 layers;
+
+// Scale from gradient length to the gradient magnitude coordinate of the tables
+uniform float gradientscale;
+#else
+// 1D texture containing the transfer function of the current frame, already
+// blended between the two active transfer functions
+uniform sampler1D transfer;
+#endif
+
+#if defined(FAN_OUT_4)
+#define OUTPUTS 4
+#elif defined(FAN_OUT_3)
+#define OUTPUTS 3
+#elif defined(FAN_OUT_2)
+#define OUTPUTS 2
+#endif
+
+#ifdef OUTPUTS
+#define FAN_OUT
+
+// Layer of the transfer function of each output: library slots for pre-integrated and 2D
+// tables, rows of transferrows otherwise
+uniform vec4 fanlayers;
+
+#if !defined(PREINTEGRATED) && !defined(CLASSIFY_2D)
+// Transfer functions of all outputs, one per row
+uniform sampler1DArray transferrows;
+#endif
+#elif defined(CAPTURE_SAMPLES)
+// Samples written by one pass, one per output
+#define OUTPUTS 8
+
+// Index of the sample written to the first output
+uniform int firstsample;
+#else
+#define OUTPUTS 1
+#endif
+
+#ifdef CACHED_SAMPLES
+// Gradient (biased to 0..1) and density of the first cachedsamples samples of each ray,
+// one sample per layer
+uniform sampler2DArray samples;
+uniform int cachedsamples;
+#endif
+
+#ifdef SHADING_TABLE
+// Illumination (.r) and silhouette modulation (.g) for the view direction of the current
+// frame, indexed by the octahedral projection of the gradient direction
+uniform sampler2D shading;
+#endif
+
+// Ray step length relative to the default step
+uniform float stepfactor = 1.0;
+
+#ifdef JITTER
+// Per-frame offset in [0, 1), added to the per-pixel ray start offset
+uniform float jitter = 0.0;
+#endif
+
+// Per-frame values shared by all programs (std140, see VolumeMapper3D::UpdateFrameData)
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	mat4 invertedmodel;
+	vec4 camerapos;
+	float transferindex;
+	vec2 targetscale;
+};
 
 // Ray direction
 in vec2 samplepos;
 
-// Final fragment color
-layout(location = 0) out vec4 out_color;
+// Final fragment color of each output
+layout(location = 0) out vec4 out_color[OUTPUTS];
 
 
 // Fetch an interpolated density value and the corresponding gradient
 // for one texture index at once. Stores the gradient in .xyz and the
 // density in .w of the returned vector.
+#ifdef FORWARD_GRADIENT
+vec4 GradientDensity(vec3 position)
+{
+    vec4 value;
+
+    value.w = texture(volume, position).r;
+    value.x = textureOffset(volume, position, ivec3(1,0,0), 0).r - value.w;
+    value.y = textureOffset(volume, position, ivec3(0,1,0), 0).r - value.w;
+    value.z = textureOffset(volume, position, ivec3(0,0,1), 0).r - value.w;
+
+    // Central differences span two voxels
+    value.xyz *= 2.0;
+
+    vec4 mul = step(-1.0, value) - step(1.0, value);
+    value *= mul.x * mul.y * mul.z * mul.w;
+
+    return value;
+}
+#else
 vec4 GradientDensity(vec3 position)
 {
     vec4 value;
@@ -56,6 +170,7 @@ vec4 GradientDensity(vec3 position)
 
     return value;
 }
+#endif
 
 vec3 Illuminate(vec3 position, vec3 raydir, vec3 normal)
 {
@@ -89,6 +204,25 @@ float SilhouetteModulation(vec3 gradient, vec3 viewdir)
     return min(opacity, 1.0);
 }
 
+#ifdef SHADING_TABLE
+// LookupShading returns illumination and silhouette modulation for a gradient. Zero gradients
+// map to the center of the table.
+vec2 LookupShading(vec3 gradient)
+{
+    vec3 n = gradient / max(abs(gradient.x) + abs(gradient.y) + abs(gradient.z), 1e-6);
+    vec2 coord = n.xy;
+
+    // The lower hemisphere is folded over the edges of the center diamond
+    if (n.z < 0.0)
+    {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        coord = (1.0 - abs(n.yx)) * signs;
+    }
+
+    return texture(shading, coord * 0.5 + 0.5).rg;
+}
+#endif
+
 float GradientMagnitudeModulation(vec3 gradient)
 {
     float magnitude = length(gradient);
@@ -96,19 +230,110 @@ float GradientMagnitudeModulation(vec3 gradient)
     return min(opacity, 1.0);
 }
 
-void main()
+#ifdef JITTER
+// Cheap per-pixel noise in [0, 1)
+float Hash(vec2 position)
+{
+    return fract(sin(dot(position, vec2(12.9898, 78.233))) * 43758.5453);
+}
+#endif
+
+// Scale a classified sample to the contribution of a ray segment which is
+// stepfactor times longer than the default step.
+vec4 CorrectOpacity(vec4 texel)
 {
-	out_color = vec4(0.0);
+    float alpha = min(texel.a * 0.5, 0.999);
+
+    if (alpha <= 0.0)
+        return texel * 0.5 * stepfactor;
 
+    float corrected = 1.0 - pow(1.0 - alpha, stepfactor);
+    return texel * (corrected / texel.a);
+}
+
+// FetchSample returns the gradient and density of the i-th sample of the ray, taken from the
+// sample cache if it holds that sample
+vec4 FetchSample(vec3 position, int i)
+{
+#ifdef CACHED_SAMPLES
+	if (i < cachedsamples)
+	{
+		vec4 cached = texelFetch(samples, ivec3(gl_FragCoord.xy, i), 0);
+		return vec4(cached.xyz * 2.0 - 1.0, cached.w);
+	}
+#endif
+
+	return GradientDensity(position);
+}
+
+#ifndef PRECLASSIFIED
+// Classify looks up the transfer function of output k for a sample. frontdensity is the
+// density at the start of the ray segment, which only pre-integrated tables use.
+vec4 Classify(float density, float frontdensity, vec3 gradient, int k)
+{
+#ifdef FAN_OUT
+	float layer = fanlayers[k];
+#elif defined(PREINTEGRATED) || defined(CLASSIFY_2D)
+	float layer = layers.x;
+#endif
+
+#if defined(PREINTEGRATED)
+	// Look up the integral over the segment from the last to the current sample
+	vec4 texel = texture(preintegration, vec3(density, frontdensity, layer));
+
+#ifdef BLEND_TRANSFER
+	// (here, we use 2 transfer functions and interpolate between them)
+	vec4 textop = texture(preintegration, vec3(density, frontdensity, layers.y));
+	texel = mix(texel, textop, fract(transferindex));
+#endif
+#elif defined(CLASSIFY_2D)
+	vec3 coord = vec3(density, length(gradient) * gradientscale, layer);
+	vec4 texel = texture(transfer2d, coord);
+
+#ifdef BLEND_TRANSFER
+	coord.z = layers.y;
+	texel = mix(texel, texture(transfer2d, coord), fract(transferindex));
+#endif
+#elif defined(FAN_OUT)
+	vec4 texel = texture(transferrows, vec2(density, layer));
+#else
+	vec4 texel = texture(transfer, density);
+#endif
+
+	return texel;
+}
+#endif
+
+// WriteOutputs copies the composited colors to the fragment outputs, which may only be
+// indexed with constants
+void WriteOutputs(vec4 color[OUTPUTS])
+{
+	out_color[0] = color[0];
+#if OUTPUTS > 1
+	out_color[1] = color[1];
+#endif
+#if OUTPUTS > 2
+	out_color[2] = color[2];
+#endif
+#if OUTPUTS > 3
+	out_color[3] = color[3];
+#endif
+}
+
+// SetupRay computes start and step of the ray through this fragment in world space and in
+// normalized texture coordinates, and the number of steps. Returns false if the ray misses
+// the volume.
+bool SetupRay(out vec3 world_pos, out vec3 world_step, out vec3 model_pos, out vec3 model_step, out float nstep)
+{
 	// Ray entry and exit points in world space
-	vec3 world_pos = texture(frontfaces, samplepos).xyz;
+	world_pos = texture(frontfaces, samplepos).xyz;
 	vec3 world_exit = texture(backfaces, samplepos).xyz;
 
 	if (world_pos == world_exit)
-		return;
+		return false;
 
 	// Ray entry and exit points in model space
-	vec3 model_pos = (invertedmodel * vec4(world_pos, 1.0)).xyz;
+	model_pos = (invertedmodel * vec4(world_pos, 1.0)).xyz;
 	vec3 model_exit = (invertedmodel * vec4(world_exit, 1.0)).xyz;
 
 	// Ray direction * distance between intersections
@@ -116,54 +341,173 @@ void main()
 	vec3 model_dir = model_exit - model_pos;
 
     // Number of steps for this ray
-    float nstep = length(model_dir) * 2.0;
+    nstep = length(model_dir) * 2.0 / stepfactor;
 
 	// Per-step ray progression
-	vec3 world_step = world_dir / nstep;
-	vec3 model_step = model_dir / nstep;
+	world_step = world_dir / nstep;
+	model_step = model_dir / nstep;
 	
 	// Convert model space ray position/step to normalized texture coordinates
     vec3 volumesize = vec3(textureSize(volume, 0));
     model_pos = (model_pos + vec3(0.5)) / volumesize;
     model_step /= volumesize;
     
-	// Size of transfer function texture
-    float maxy = float(textureSize(transfer, 0).y);
+#ifdef JITTER
+	// Move the ray start forward by a fraction of a step, so successive frames
+	// sample in between each other
+	float offset = fract(Hash(gl_FragCoord.xy) + jitter);
+	world_pos += world_step * offset;
+	model_pos += model_step * offset;
+	nstep -= offset;
+#endif
+
+	return true;
+}
+
+#ifdef CAPTURE_SAMPLES
+void main()
+{
+	vec4 color[OUTPUTS];
+
+	for (int k = 0; k < OUTPUTS; k++)
+		color[k] = vec4(0.0);
+
+	vec3 world_pos, world_step, model_pos, model_step;
+	float nstep;
+
+	if (SetupRay(world_pos, world_step, model_pos, model_step, nstep))
+	{
+		for (int k = 0; k < OUTPUTS; k++)
+		{
+			int i = firstsample + k;
+
+			if (i >= nstep)
+				break;
+
+			vec4 tmp = GradientDensity(model_pos + model_step * float(i));
+			color[k] = vec4(tmp.xyz * 0.5 + 0.5, tmp.w);
+		}
+	}
+
+	WriteOutputs(color);
+}
+#else
+void main()
+{
+	vec4 color[OUTPUTS];
+
+	for (int k = 0; k < OUTPUTS; k++)
+		color[k] = vec4(0.0);
+
+	vec3 world_pos, world_step, model_pos, model_step;
+	float nstep;
+
+	if (!SetupRay(world_pos, world_step, model_pos, model_step, nstep))
+	{
+		WriteOutputs(color);
+		return;
+	}
+
+#ifdef PREINTEGRATED
+	// Density at the front of the current ray segment
+	float frontdensity = FetchSample(model_pos, 0).w;
+#else
+	float frontdensity = 0.0;
+#endif
 	
 	for (int i = 0; i < nstep; i++)
 	{
-		// 1st step: Sample volume at the current ray position
-        vec4 tmp = GradientDensity(model_pos);
+#ifdef PRECLASSIFIED
+		// Classification and gradient magnitude modulation are part of the voxels already
+		color[0] += (1.0 - color[0].a) * CorrectOpacity(texture(classified, model_pos));
+
+		if (color[0].a >= 0.9)
+		{
+			break;
+		}
+#else
+		// 1st step: Sample volume at the current ray position, once for all outputs
+        vec4 tmp = FetchSample(model_pos, i);
 		float density = tmp.w;
 		vec3 gradient = tmp.xyz;
-        
-		// 2nd step: Find a matching transfer function entry for the sample density
-		// (here, we use 2 transfer functions and interpolate between them)
-		vec2 cordbottom = vec2(density, transferindex / maxy);
-        vec2 cordtop = vec2(density, (transferindex + 1.0) / maxy);
-        
-		vec4 texbottom = texture(transfer, cordbottom);
-        vec4 textop = texture(transfer, cordtop);
-        
-		vec4 texel = mix(texbottom, textop, fract(transferindex));
-		
-		// 3rd Step: Shading / Illumination
-		vec3 viewdir = world_pos - camerapos;
-
-        texel.rgb *= Illuminate(world_pos, viewdir, gradient);
-
-        texel.a *= GradientMagnitudeModulation(gradient);
-        texel.a *= SilhouetteModulation(gradient, viewdir);
-
-        out_color += (1.0 - out_color.a) * texel * 0.5;
-
-		if (out_color.a >= 0.9)
+
+		vec3 viewdir = world_pos - camerapos.xyz;
+
+		// Shading only depends on the sample, so it is computed once when the first
+		// output needs it
+		bool shaded = false;
+		vec3 illumination = vec3(1.0);
+		float modulation = 1.0;
+
+		bool done = true;
+
+		for (int k = 0; k < OUTPUTS; k++)
+		{
+			if (color[k].a >= 0.9)
+				continue;
+
+			// 2nd step: Find a matching transfer function entry for the sample density
+			vec4 texel = Classify(density, frontdensity, gradient, k);
+
+#ifdef SKIP_EMPTY
+			if (texel.a > 0.0)
+#endif
+			{
+				// 3rd Step: Shading / Illumination
+				if (!shaded)
+				{
+#ifdef SHADING_TABLE
+					vec2 lookup = LookupShading(gradient);
+#ifdef LIGHTING
+					illumination = vec3(lookup.r);
+#endif
+
+#ifdef MODULATION
+#ifndef CLASSIFY_2D
+					modulation *= GradientMagnitudeModulation(gradient);
+#endif
+					modulation *= lookup.g;
+#endif
+#else
+#ifdef LIGHTING
+					illumination = Illuminate(world_pos, viewdir, gradient);
+#endif
+
+#ifdef MODULATION
+#ifndef CLASSIFY_2D
+					// 2D transfer functions include the gradient magnitude already
+					modulation *= GradientMagnitudeModulation(gradient);
+#endif
+					modulation *= SilhouetteModulation(gradient, viewdir);
+#endif
+#endif
+					shaded = true;
+				}
+
+				texel.rgb *= illumination;
+				texel.a *= modulation;
+
+				color[k] += (1.0 - color[k].a) * CorrectOpacity(texel);
+			}
+
+			done = done && color[k].a >= 0.9;
+		}
+
+#ifdef PREINTEGRATED
+		frontdensity = density;
+#endif
+
+		if (done)
 		{
 			break;
 		}
+#endif
 
         world_pos += world_step;
         model_pos += model_step;
     }
+
+	WriteOutputs(color);
 }
+#endif
 
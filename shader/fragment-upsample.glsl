@@ -0,0 +1,80 @@
+#version 330 core
+
+// Volume rendered at reduced resolution into the lower left part of the texture
+uniform sampler2D image;
+
+// Reduced resolution relative to the window
+uniform vec2 uvscale;
+
+// 2D textures containing the front/back face coordinates at full resolution
+uniform sampler2D frontfaces;
+uniform sampler2D backfaces;
+
+// Per-frame values shared by all programs (std140, see VolumeMapper3D::UpdateFrameData)
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	mat4 invertedmodel;
+	vec4 camerapos;
+	float transferindex;
+	vec2 targetscale;
+};
+
+// Texture coordinates
+in vec2 samplepos;
+
+// Final fragment color
+layout(location = 0) out vec4 out_color;
+
+void main()
+{
+	// Ray entry and exit point of this pixel guide the filter
+	vec3 front = texture(frontfaces, samplepos).xyz;
+	vec3 back = texture(backfaces, samplepos).xyz;
+	bool hit = front != back;
+
+	// World space distance covered by one low resolution pixel on the entry surface
+	float footprint = max(length(fwidth(front)) / uvscale.x, 1.0e-4);
+
+	vec2 imagesize = vec2(textureSize(image, 0));
+	vec2 lowpos = samplepos * uvscale * imagesize - 0.5;
+	vec2 base = floor(lowpos);
+	vec2 f = lowpos - base;
+
+	vec4 color = vec4(0.0);
+	vec4 bilinear = vec4(0.0);
+	float weightsum = 0.0;
+
+	// Bilinear interpolation between the 4 nearest low resolution pixels, but
+	// neglect those which lie across an edge of the bounding box
+	for (int i = 0; i < 4; i++)
+	{
+		vec2 offset = vec2(i & 1, i >> 1);
+		vec2 uv = (base + offset + 0.5) / imagesize;
+		uv = clamp(uv, 0.5 / imagesize, uvscale * targetscale - 0.5 / imagesize);
+
+		vec4 texel = texture(image, uv);
+
+		vec2 weights = mix(1.0 - f, f, offset);
+		float weight = weights.x * weights.y;
+		bilinear += weight * texel;
+
+		vec3 neighborfront = texture(frontfaces, uv / uvscale).xyz;
+		vec3 neighborback = texture(backfaces, uv / uvscale).xyz;
+
+		if (hit != (neighborfront != neighborback))
+			continue;
+
+		weight *= exp(-distance(front, neighborfront) / (2.0 * footprint));
+
+		color += weight * texel;
+		weightsum += weight;
+	}
+
+	// No neighbor on the same side of the edge: fall back to plain interpolation
+	if (weightsum > 1.0e-4)
+		out_color = color / weightsum;
+	else
+		out_color = bilinear;
+}
@@ -6,11 +6,23 @@ layout(location = 0) in vec2 vertex;
 // Texture coordinates
 layout(location = 1) in vec2 uv;
 
-// Sampling position for front/back face buffer
+// Per-frame values shared by all programs (std140, see VolumeMapper3D::UpdateFrameData).
+// targetscale is the part of each offscreen target covered by the window.
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	mat4 invertedmodel;
+	vec4 camerapos;
+	float transferindex;
+	vec2 targetscale;
+};
+
+// Sampling position for front/back face buffer and other offscreen targets
 out vec2 samplepos;
 
 void main()
 {
 	gl_Position = vec4(vertex, 0.0, 1.0);
-	samplepos = uv;
+	samplepos = uv * targetscale;
 }
@@ -3,11 +3,16 @@
 // Vertex coordinates of bounding box
 layout(location = 0) in vec3 vertex;
 
-// View Matrix
-uniform mat4 view;
-
-// Projection matrix
-uniform mat4 projection;
+// Per-frame values shared by all programs (std140, see VolumeMapper3D::UpdateFrameData)
+layout(std140) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	mat4 invertedmodel;
+	vec4 camerapos;
+	float transferindex;
+	vec2 targetscale;
+};
 
 // Per-fragment position
 out vec4 fragpos;
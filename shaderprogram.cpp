@@ -2,6 +2,8 @@
 #include "opengl.h"
 
 #include <stdio.h>
+#include <string.h>
+
 
 ShaderProgram::ShaderProgram() : program(0), log(NULL)
 {
@@ -21,6 +23,8 @@ void ShaderProgram::Destroy()
 		this->program = 0;
 	}
 
+	this->uniforms.clear();
+
 	if (this->log != NULL)
 	{
 		delete[] this->log;
@@ -28,7 +32,7 @@ void ShaderProgram::Destroy()
 	}
 }
 
-unsigned int ShaderProgram::CompileShader(unsigned int type, const char *src)
+unsigned int ShaderProgram::CompileShader(unsigned int type, const char *src, const char *defines)
 {
 	GLuint handle = glCreateShader(type);
 
@@ -38,7 +42,28 @@ unsigned int ShaderProgram::CompileShader(unsigned int type, const char *src)
 		return 0;
 	}
 
-	glShaderSource(handle, 1, &src, NULL);
+	if (defines == NULL)
+	{
+		glShaderSource(handle, 1, &src, NULL);
+	}
+	else
+	{
+		// The #version directive must come first, so the defines are passed as a separate
+		// string right after the line containing it.
+		const char *body = src;
+		const char *version = strstr(src, "#version");
+
+		if (version != NULL)
+		{
+			const char *eol = strchr(version, '\n');
+			body = eol != NULL ? eol + 1 : version + strlen(version);
+		}
+
+		const char *strings[3] = { src, defines, body };
+		const GLint lengths[3] = { (GLint)(body - src), -1, -1 };
+
+		glShaderSource(handle, 3, strings, lengths);
+	}
 	CheckGLError();
 
 	glCompileShader(handle);
@@ -70,16 +95,16 @@ unsigned int ShaderProgram::CompileShader(unsigned int type, const char *src)
 	return 0;
 }
 
-bool ShaderProgram::Build(const char *vsrc, const char *fsrc)
+bool ShaderProgram::Build(const char *vsrc, const char *fsrc, const char *defines)
 {
-	GLuint vshader = CompileShader(GL_VERTEX_SHADER, vsrc);
+	GLuint vshader = CompileShader(GL_VERTEX_SHADER, vsrc, defines);
 
 	if (vshader == 0)
 	{
 		return false;
 	}
 
-	GLuint fshader = CompileShader(GL_FRAGMENT_SHADER, fsrc);
+	GLuint fshader = CompileShader(GL_FRAGMENT_SHADER, fsrc, defines);
 
 	if (fshader == 0)
 	{
@@ -99,6 +124,10 @@ bool ShaderProgram::Build(const char *vsrc, const char *fsrc)
 
 	glAttachShader(prog, vshader);
 	glAttachShader(prog, fshader);
+
+	if (BinarySupported())
+		glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 	glLinkProgram(prog);
 	CheckGLError();
 
@@ -111,6 +140,7 @@ bool ShaderProgram::Build(const char *vsrc, const char *fsrc)
 	if (result == GL_TRUE)
 	{
 		this->program = prog;
+		CacheLocations();
 		return true;
 	}
 
@@ -136,40 +166,147 @@ const char *ShaderProgram::GetBuildLog()
 	return this->log;
 }
 
-void ShaderProgram::Enable()
+bool ShaderProgram::BinarySupported()
 {
-	if (this->program != 0)
+	// Available with OpenGL 4.1 or ARB_get_program_binary
+	static int supported = -1;
+
+	if (supported < 0)
 	{
-		glUseProgram(this->program);
-		CheckGLError();
+		GLint formats = 0;
+
+		if (glGetProgramBinary != NULL && glProgramBinary != NULL && glProgramParameteri != NULL)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+		supported = formats > 0 ? 1 : 0;
 	}
+
+	return supported == 1;
 }
 
-void ShaderProgram::Disable()
+bool ShaderProgram::LoadBinary(unsigned int format, const void *data, int size)
 {
-	glUseProgram(0);
+	Destroy();
+
+	if (!BinarySupported())
+		return false;
+
+	GLuint prog = glCreateProgram();
+	CheckGLError();
+
+	if (prog == 0)
+		return false;
+
+	glProgramBinary(prog, format, data, size);
+
+	GLint result;
+	glGetProgramiv(prog, GL_LINK_STATUS, &result);
+
+	if (result != GL_TRUE)
+	{
+		// Rejected binaries may also raise GL_INVALID_ENUM, which is expected here
+		glGetError();
+		glDeleteProgram(prog);
+		return false;
+	}
+
+	this->program = prog;
+	CacheLocations();
+	return true;
 }
 
-int ShaderProgram::GetUniformLocation(const char *name)
+void ShaderProgram::CacheLocations()
 {
-	int loc = glGetUniformLocation(this->program, name);
+	this->uniforms.clear();
+
+	GLint count = 0;
+	GLint maxlength = 0;
+
+	glGetProgramiv(this->program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(this->program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxlength);
+
+	std::vector<char> name(maxlength + 1);
+
+	for (int i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(this->program, i, maxlength + 1, NULL, &size, &type, &name[0]);
+
+		// Members of uniform blocks have no location
+		const int loc = glGetUniformLocation(this->program, &name[0]);
+		if (loc < 0)
+			continue;
+
+		// Arrays are reported as name[0], but looked up by their plain name
+		char *bracket = strchr(&name[0], '[');
+		if (bracket != NULL)
+			*bracket = 0;
+
+		this->uniforms.push_back(std::make_pair(std::string(&name[0]), loc));
+	}
+
+	CheckGLError();
+}
+
+char *ShaderProgram::GetBinary(unsigned int *format, int *size)
+{
+	if (this->program == 0 || !BinarySupported())
+		return NULL;
+
+	GLint len = 0;
+	glGetProgramiv(this->program, GL_PROGRAM_BINARY_LENGTH, &len);
+
+	if (len <= 0)
+		return NULL;
 
-	if (loc < 0)
+	char *data = new char[len];
+
+	GLsizei written = 0;
+	GLenum binaryformat = 0;
+	glGetProgramBinary(this->program, len, &written, &binaryformat, data);
+	CheckGLError();
+
+	if (written <= 0)
 	{
-		fprintf(stderr, "Can't locate uniform %s\n", name);
+		delete[] data;
+		return NULL;
 	}
 
-	return loc;
+	*format = binaryformat;
+	*size = written;
+
+	return data;
 }
 
-int ShaderProgram::GetAttributeLocation(const char *name)
+unsigned int ShaderProgram::GetProgram()
 {
-	int loc = glGetAttribLocation(this->program, name);
+	return this->program;
+}
 
-	if (loc < 0)
+int ShaderProgram::FindLocation(const LocationList &list, const char *name)
+{
+	for (size_t i = 0; i < list.size(); i++)
 	{
-		fprintf(stderr, "Can't locate attribute %s\n", name);
+		if (strcmp(list[i].first.c_str(), name) == 0)
+			return list[i].second;
 	}
 
-	return loc;
+	return -1;
+}
+
+int ShaderProgram::GetUniformLocation(const char *name)
+{
+	return FindLocation(this->uniforms, name);
+}
+
+void ShaderProgram::BindUniformBlock(const char *name, unsigned int binding)
+{
+	const GLuint index = glGetUniformBlockIndex(this->program, name);
+
+	if (index != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(this->program, index, binding);
+		CheckGLError();
+	}
 }
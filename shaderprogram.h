@@ -1,27 +1,59 @@
 #ifndef SHADER_PROGRAM_H
 #define SHADER_PROGRAM_H
 
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
 class ShaderProgram
 {
 	unsigned int program;
 	char *log;
 
-	unsigned int CompileShader(unsigned int type, const char *src);
+	// Locations of all active uniforms, resolved once after linking. Programs have few of them,
+	// so they are searched linearly.
+	typedef std::vector<std::pair<std::string, int> > LocationList;
+	LocationList uniforms;
+
+	unsigned int CompileShader(unsigned int type, const char *src, const char *defines);
+	void CacheLocations();
+	static int FindLocation(const LocationList &list, const char *name);
 
 public:
 	ShaderProgram();
 	~ShaderProgram();
 
-	bool Build(const char *vsrc, const char *fsrc);
+	// Build compiles and links a program from vertex and fragment shader sources. If defines
+	// is not NULL, it is inserted into both sources right after the #version directive.
+	bool Build(const char *vsrc, const char *fsrc, const char *defines = NULL);
 	const char *GetBuildLog();
 
+	// BinarySupported returns true if programs can be saved and restored in binary form.
+	static bool BinarySupported();
+
+	// LoadBinary creates the program from data previously returned by GetBinary. It fails
+	// if the driver rejects the binary, e.g. because the driver has been updated since.
+	bool LoadBinary(unsigned int format, const void *data, int size);
+
+	// GetBinary returns the driver specific binary representation of the program. The
+	// returned array must be deleted by the caller. Returns NULL on error.
+	char *GetBinary(unsigned int *format, int *size);
+
 	void Destroy();
 
-	void Enable();
-	void Disable();
+	// GetProgram returns the GL program object, or 0 if the program has not been built. It is
+	// bound through the GLStateCache of the context.
+	unsigned int GetProgram();
 
+	// GetUniformLocation doesn't query the driver. It returns -1 if the program has no active
+	// uniform of the given name.
 	int GetUniformLocation(const char *name);
-	int GetAttributeLocation(const char *name);
+
+	// BindUniformBlock assigns the uniform block of the given name to a binding point, if
+	// the program uses it.
+	void BindUniformBlock(const char *name, unsigned int binding);
 };
 
 #endif // SHADER_PROGRAM_H
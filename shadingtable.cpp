@@ -0,0 +1,89 @@
+#include "shadingtable.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Same as Illuminate and SilhouetteModulation in fragment-raycast.glsl
+static const float AMBIENT = 0.3f;
+static const float DIFFUSE = 0.6f;
+static const float SPECULAR = 0.5f;
+static const float SHININESS = 50.0f;
+
+ShadingTable::ShadingTable() : table(SIZE * SIZE * 2, 0.0f), valid(false)
+{
+	memset(this->viewdir, 0, sizeof(this->viewdir));
+}
+
+void ShadingTable::Decode(int x, int y, float direction[3])
+{
+	// Upper hemisphere in the center diamond, the lower one folded over its edges
+	float u = (x + 0.5f) / SIZE * 2.0f - 1.0f;
+	float v = (y + 0.5f) / SIZE * 2.0f - 1.0f;
+	const float z = 1.0f - fabsf(u) - fabsf(v);
+
+	if (z < 0.0f)
+	{
+		const float fu = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		const float fv = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+		u = fu;
+		v = fv;
+	}
+
+	const float length = sqrtf(u * u + v * v + z * z);
+
+	direction[0] = u / length;
+	direction[1] = v / length;
+	direction[2] = z / length;
+}
+
+bool ShadingTable::Update(const float viewdir[3])
+{
+	if (this->valid && memcmp(viewdir, this->viewdir, sizeof(this->viewdir)) == 0)
+		return false;
+
+	// The light is at the camera, so it shines along the view direction
+	const float light[3] = { -viewdir[0], -viewdir[1], -viewdir[2] };
+
+	const float half[3] = { viewdir[0] + light[0], viewdir[1] + light[1], viewdir[2] + light[2] };
+	const float halflength = sqrtf(half[0] * half[0] + half[1] * half[1] + half[2] * half[2]);
+
+	for (int y = 0; y < SIZE; y++)
+	{
+		for (int x = 0; x < SIZE; x++)
+		{
+			float normal[3];
+			Decode(x, y, normal);
+
+			const float diffuse = normal[0] * light[0] + normal[1] * light[1] + normal[2] * light[2];
+
+			// A vanishing half vector contributes no specular light, like max() on the GPU
+			// returns 0 for the undefined result of normalizing it
+			float specular = 0.0f;
+
+			if (halflength > 0.0f)
+			{
+				const float cosine = (normal[0] * half[0] + normal[1] * half[1] + normal[2] * half[2]) / halflength;
+				specular = SPECULAR * powf(std::max(0.0f, cosine), SHININESS);
+			}
+
+			const float facing = fabsf(normal[0] * viewdir[0] + normal[1] * viewdir[1] + normal[2] * viewdir[2]);
+			const float silhouette = std::min(0.9f + 15.0f * powf(std::max(0.0f, 1.0f - facing), 0.25f), 1.0f);
+
+			float *entry = &this->table[(y * SIZE + x) * 2];
+			entry[0] = AMBIENT + DIFFUSE * std::max(0.0f, diffuse) + specular;
+			entry[1] = silhouette;
+		}
+	}
+
+	memcpy(this->viewdir, viewdir, sizeof(this->viewdir));
+	this->valid = true;
+
+	return true;
+}
+
+const float *ShadingTable::GetTable()
+{
+	return this->table.data();
+}
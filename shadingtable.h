@@ -0,0 +1,37 @@
+#ifndef SHADING_TABLE_H
+#define SHADING_TABLE_H
+
+#include <vector>
+
+// ShadingTable holds the illumination and silhouette modulation of the ray caster for all
+// gradient directions at once. With the light at the camera, both only depend on the angle
+// between gradient and view direction, so a table built once per frame from the direction
+// of projection replaces the shading math of every sample by one lookup. Directions are
+// mapped to the table by an octahedral projection. Rays of a perspective camera deviate
+// from the direction of projection, which the table doesn't take into account.
+class ShadingTable
+{
+	// Illumination and silhouette modulation of each entry
+	std::vector<float> table;
+
+	float viewdir[3];
+	bool valid;
+
+	// Decode returns the unit direction at the center of an entry
+	static void Decode(int x, int y, float direction[3]);
+
+public:
+	// Entries along each axis of the table
+	static const int SIZE = 64;
+
+	ShadingTable();
+
+	// Update rebuilds the table if the normalized view direction has changed. Returns true if
+	// the table has been rebuilt.
+	bool Update(const float viewdir[3]);
+
+	// GetTable returns SIZE * SIZE pairs of illumination and silhouette modulation
+	const float *GetTable();
+};
+
+#endif // SHADING_TABLE_H
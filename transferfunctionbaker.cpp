@@ -0,0 +1,344 @@
+#include "transferfunctionbaker.h"
+
+#include <vtkColorTransferFunction.h>
+#include <vtkPiecewiseFunction.h>
+#include <vtkSmartPointer.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <QElapsedTimer>
+
+// Node settings which make VTK interpolate linearly
+static const double LINEAR_MIDPOINT = 0.5;
+static const double LINEAR_SHARPNESS = 0.01;
+
+// Number of bakes timed by Benchmark
+static const int BENCHMARK_ITERATIONS = 200;
+
+bool TransferFunctionBaker::GetLinearNodes(vtkColorTransferFunction *color, double *&x, double *&values, int &nrnodes)
+{
+	nrnodes = color->GetSize();
+
+	if (nrnodes < 1 || color->GetColorSpace() != VTK_CTF_RGB || color->GetScale() != VTK_CTF_LINEAR || !color->GetClamping())
+		return false;
+
+	x = new double[nrnodes];
+	values = new double[nrnodes * 3];
+
+	for (int i = 0; i < nrnodes; i++)
+	{
+		// x, r, g, b, midpoint, sharpness
+		double node[6];
+		color->GetNodeValue(i, node);
+
+		// Nodes must be strictly increasing, VTK handles duplicates on its own
+		const bool linear = node[4] == LINEAR_MIDPOINT && node[5] < LINEAR_SHARPNESS;
+
+		if (!linear || (i > 0 && node[0] <= x[i - 1]))
+		{
+			delete[] x;
+			delete[] values;
+			return false;
+		}
+
+		x[i] = node[0];
+		values[i * 3 + 0] = node[1];
+		values[i * 3 + 1] = node[2];
+		values[i * 3 + 2] = node[3];
+	}
+
+	return true;
+}
+
+bool TransferFunctionBaker::GetLinearNodes(vtkPiecewiseFunction *opacity, double *&x, double *&values, int &nrnodes)
+{
+	nrnodes = opacity->GetSize();
+
+	if (nrnodes < 1 || !opacity->GetClamping())
+		return false;
+
+	x = new double[nrnodes];
+	values = new double[nrnodes];
+
+	for (int i = 0; i < nrnodes; i++)
+	{
+		// x, y, midpoint, sharpness
+		double node[4];
+		opacity->GetNodeValue(i, node);
+
+		const bool linear = node[2] == LINEAR_MIDPOINT && node[3] < LINEAR_SHARPNESS;
+
+		if (!linear || (i > 0 && node[0] <= x[i - 1]))
+		{
+			delete[] x;
+			delete[] values;
+			return false;
+		}
+
+		x[i] = node[0];
+		values[i] = node[1];
+	}
+
+	return true;
+}
+
+void TransferFunctionBaker::Sweep(const double *x, const double *values, int nrnodes, int channels, int first, int count, double *out)
+{
+	const int end = first + count;
+	int i = first;
+
+	// Up to the first node, its value is repeated (clamping)
+	for (; i < end && (double)(i + OFFSET) <= x[0]; i++)
+	{
+		for (int c = 0; c < channels; c++)
+			out[i * channels + c] = values[c];
+	}
+
+	// Each segment covers the values in (x1, x2], which is where VTK uses it as well. The
+	// expressions must stay the same as in VTK to get identical results.
+	for (int n = 1; n < nrnodes; n++)
+	{
+		const double x1 = x[n - 1];
+		const double x2 = x[n];
+		const double *v1 = &values[(n - 1) * channels];
+		const double *v2 = &values[n * channels];
+
+		for (; i < end && (double)(i + OFFSET) <= x2; i++)
+		{
+			const double s = ((double)(i + OFFSET) - x1) / (x2 - x1);
+
+			for (int c = 0; c < channels; c++)
+				out[i * channels + c] = (1 - s) * v1[c] + s * v2[c];
+		}
+	}
+
+	// Past the last node
+	const double *last = &values[(nrnodes - 1) * channels];
+
+	for (; i < end; i++)
+	{
+		for (int c = 0; c < channels; c++)
+			out[i * channels + c] = last[c];
+	}
+}
+
+void TransferFunctionBaker::Bake(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, uint8_t *rgba, int first, int count)
+{
+	double *colorx, *colorvalues;
+	double *opacityx, *opacityvalues;
+	int nrcolors, nropacities;
+
+	if (!GetLinearNodes(color, colorx, colorvalues, nrcolors))
+	{
+		BakeReference(color, opacity, rgba, first, count);
+		return;
+	}
+
+	if (!GetLinearNodes(opacity, opacityx, opacityvalues, nropacities))
+	{
+		delete[] colorx;
+		delete[] colorvalues;
+
+		BakeReference(color, opacity, rgba, first, count);
+		return;
+	}
+
+	std::vector<double> rgb(SIZE * 3);
+	std::vector<double> alpha(SIZE);
+
+	Sweep(colorx, colorvalues, nrcolors, 3, first, count, rgb.data());
+	Sweep(opacityx, opacityvalues, nropacities, 1, first, count, alpha.data());
+
+	delete[] colorx;
+	delete[] colorvalues;
+	delete[] opacityx;
+	delete[] opacityvalues;
+
+	// Same operations as BakeReference
+	for (int i = first; i < first + count; i++)
+	{
+		const double a = alpha[i];
+
+		rgba[i * 4 + 0] = (uint8_t)((rgb[i * 3 + 0] * a) * 255.0);
+		rgba[i * 4 + 1] = (uint8_t)((rgb[i * 3 + 1] * a) * 255.0);
+		rgba[i * 4 + 2] = (uint8_t)((rgb[i * 3 + 2] * a) * 255.0);
+		rgba[i * 4 + 3] = (uint8_t)(a * 255.0);
+	}
+}
+
+void TransferFunctionBaker::BakeReference(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, uint8_t *rgba, int first, int count)
+{
+	double value[4];
+
+	for (int i = first; i < first + count; i++)
+	{
+		color->GetColor(i + OFFSET, value);
+		value[3] = opacity->GetValue(i + OFFSET);
+
+		value[0] *= value[3];
+		value[1] *= value[3];
+		value[2] *= value[3];
+
+		rgba[i * 4 + 0] = (uint8_t)(value[0] * 255.0);
+		rgba[i * 4 + 1] = (uint8_t)(value[1] * 255.0);
+		rgba[i * 4 + 2] = (uint8_t)(value[2] * 255.0);
+		rgba[i * 4 + 3] = (uint8_t)(value[3] * 255.0);
+	}
+}
+
+bool TransferFunctionBaker::BakeGradient(vtkPiecewiseFunction *gradient, uint8_t *out)
+{
+	bool opaque = true;
+
+	for (int i = 0; i < GRADIENT_SIZE; i++)
+	{
+		const double magnitude = ((double)i + 0.5) * GRADIENT_RANGE / GRADIENT_SIZE;
+		const double value = std::min(1.0, std::max(0.0, gradient->GetValue(magnitude)));
+
+		out[i] = (uint8_t)(value * 255.0);
+		opaque = opaque && out[i] == 255;
+	}
+
+	return !opaque;
+}
+
+void TransferFunctionBaker::GetNodes(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, TransferFunctionNodes &nodes)
+{
+	const int nrcolors = color->GetSize();
+	nodes.color.resize(nrcolors * 6);
+
+	for (int i = 0; i < nrcolors; i++)
+		color->GetNodeValue(i, &nodes.color[i * 6]);
+
+	const int nropacities = opacity->GetSize();
+	nodes.opacity.resize(nropacities * 4);
+
+	for (int i = 0; i < nropacities; i++)
+		opacity->GetNodeValue(i, &nodes.opacity[i * 4]);
+
+	nodes.colorspace = color->GetColorSpace();
+	nodes.scale = color->GetScale();
+	nodes.colorclamping = color->GetClamping();
+	nodes.opacityclamping = opacity->GetClamping();
+}
+
+bool TransferFunctionBaker::GetChangedInterval(const std::vector<double> &previous, const std::vector<double> &current, int stride, double &lower, double &upper)
+{
+	const int nrprevious = (int)previous.size() / stride;
+	const int nrcurrent = (int)current.size() / stride;
+	const int nrcommon = std::min(nrprevious, nrcurrent);
+
+	// Equal nodes at the start and the end of both lists
+	int prefix = 0;
+
+	while (prefix < nrcommon && memcmp(&previous[prefix * stride], &current[prefix * stride], stride * sizeof(double)) == 0)
+		prefix++;
+
+	if (prefix == nrprevious && prefix == nrcurrent)
+		return false;
+
+	int suffix = 0;
+
+	while (suffix < nrcommon - prefix && memcmp(&previous[(nrprevious - 1 - suffix) * stride], &current[(nrcurrent - 1 - suffix) * stride], stride * sizeof(double)) == 0)
+		suffix++;
+
+	// Everything between the last equal node before and the first equal node after the
+	// changed ones. Segments end at nodes, so nothing outside can be affected.
+	lower = prefix > 0 ? current[(prefix - 1) * stride] : -HUGE_VAL;
+	upper = suffix > 0 ? current[(nrcurrent - suffix) * stride] : HUGE_VAL;
+
+	return true;
+}
+
+bool TransferFunctionBaker::GetChangedRange(const TransferFunctionNodes &previous, const TransferFunctionNodes &current, int &first, int &count)
+{
+	first = 0;
+	count = SIZE;
+
+	if (previous.colorspace != current.colorspace || previous.scale != current.scale ||
+		previous.colorclamping != current.colorclamping || previous.opacityclamping != current.opacityclamping)
+		return true;
+
+	double colorlower, colorupper;
+	double opacitylower, opacityupper;
+
+	const bool color = GetChangedInterval(previous.color, current.color, 6, colorlower, colorupper);
+	const bool opacity = GetChangedInterval(previous.opacity, current.opacity, 4, opacitylower, opacityupper);
+
+	if (!color && !opacity)
+		return false;
+
+	double lower = HUGE_VAL;
+	double upper = -HUGE_VAL;
+
+	if (color)
+	{
+		lower = colorlower;
+		upper = colorupper;
+	}
+
+	if (opacity)
+	{
+		lower = std::min(lower, opacitylower);
+		upper = std::max(upper, opacityupper);
+	}
+
+	// Entries at the bounds themselves are included
+	const double lowerentry = std::max(floor(lower) - OFFSET, 0.0);
+	const double upperentry = std::min(ceil(upper) - OFFSET, (double)(SIZE - 1));
+
+	if (lowerentry > upperentry)
+		return false;
+
+	first = (int)lowerentry;
+	count = (int)upperentry - first + 1;
+
+	return true;
+}
+
+bool TransferFunctionBaker::Benchmark(FILE *out)
+{
+	// Similar to the functions created in the transfer function dialog, with nodes at
+	// fractional positions and outside the baked range
+	vtkSmartPointer<vtkColorTransferFunction> color = vtkSmartPointer<vtkColorTransferFunction>::New();
+	color->AddRGBPoint(-2048.0, 0.0, 0.0, 0.0);
+	color->AddRGBPoint(-400.5, 0.55, 0.25, 0.15);
+	color->AddRGBPoint(150.0, 0.88, 0.60, 0.29);
+	color->AddRGBPoint(600.25, 1.0, 0.94, 0.95);
+	color->AddRGBPoint(1200.0, 0.3, 0.3, 1.0);
+	color->AddRGBPoint(3000.0, 1.0, 1.0, 1.0);
+
+	vtkSmartPointer<vtkPiecewiseFunction> opacity = vtkSmartPointer<vtkPiecewiseFunction>::New();
+	opacity->AddPoint(-1024.0, 0.0);
+	opacity->AddPoint(-350.0, 0.0);
+	opacity->AddPoint(-100.75, 0.15);
+	opacity->AddPoint(300.0, 0.4);
+	opacity->AddPoint(900.0, 0.85);
+	opacity->AddPoint(3071.0, 1.0);
+
+	std::vector<uint8_t> reference(SIZE * 4);
+	std::vector<uint8_t> baked(SIZE * 4);
+
+	QElapsedTimer timer;
+
+	timer.start();
+	for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+		BakeReference(color, opacity, reference.data());
+	const double referencetime = (double)timer.nsecsElapsed() / 1.0e6 / BENCHMARK_ITERATIONS;
+
+	timer.start();
+	for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+		Bake(color, opacity, baked.data());
+	const double baketime = (double)timer.nsecsElapsed() / 1.0e6 / BENCHMARK_ITERATIONS;
+
+	const bool identical = memcmp(reference.data(), baked.data(), SIZE * 4) == 0;
+
+	fprintf(out, "Transfer function baking: %.3f ms per function with VTK, %.3f ms with sweep (%.1fx), results %s\n",
+		referencetime, baketime, referencetime / baketime, identical ? "identical" : "DIFFER");
+
+	return identical;
+}
@@ -0,0 +1,84 @@
+#ifndef TRANSFER_FUNCTION_BAKER_H
+#define TRANSFER_FUNCTION_BAKER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+class vtkColorTransferFunction;
+class vtkPiecewiseFunction;
+
+// Copy of the nodes and settings of a color and an opacity function, which tells the range of
+// entries affected by a change
+struct TransferFunctionNodes
+{
+	// x, r, g, b, midpoint, sharpness per node
+	std::vector<double> color;
+
+	// x, y, midpoint, sharpness per node
+	std::vector<double> opacity;
+
+	int colorspace;
+	int scale;
+	int colorclamping;
+	int opacityclamping;
+};
+
+// TransferFunctionBaker evaluates a color and an opacity function at the 4096 scalar values
+// -1024 to 3071 and stores the result as premultiplied RGBA8. Functions which only use linear
+// interpolation in RGB space are evaluated by a single sweep over their nodes, which gives
+// the same results as the per-value VTK calls. All other functions are passed to VTK.
+class TransferFunctionBaker
+{
+	virtual ~TransferFunctionBaker() = 0;
+
+	// Copies the nodes of a function with linear segments to x and values, with channels
+	// values per node. Returns false if the function needs VTK to be evaluated.
+	static bool GetLinearNodes(vtkColorTransferFunction *color, double *&x, double *&values, int &nrnodes);
+	static bool GetLinearNodes(vtkPiecewiseFunction *opacity, double *&x, double *&values, int &nrnodes);
+
+	// Evaluates channels interleaved values per scalar value for the entries first to
+	// first + count - 1 into out, which holds values for all entries
+	static void Sweep(const double *x, const double *values, int nrnodes, int channels, int first, int count, double *out);
+
+	// Range of x values whose results may differ between two node lists with stride values
+	// per node. Returns false if the lists are equal.
+	static bool GetChangedInterval(const std::vector<double> &previous, const std::vector<double> &current, int stride, double &lower, double &upper);
+
+public:
+	static const int SIZE = 4096;
+
+	// Scalar value of the first entry
+	static const int OFFSET = -1024;
+
+	// Gradient opacity functions are sampled at GRADIENT_SIZE gradient magnitudes, the centers
+	// of equal intervals from 0 to GRADIENT_RANGE scalar units per voxel
+	static const int GRADIENT_SIZE = 256;
+	static const int GRADIENT_RANGE = 1024;
+
+	// Bake writes the premultiplied RGBA values of the entries first to first + count - 1 to
+	// rgba, which holds all SIZE entries
+	static void Bake(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, uint8_t *rgba, int first = 0, int count = SIZE);
+
+	// BakeReference always calls VTK for every value
+	static void BakeReference(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, uint8_t *rgba, int first = 0, int count = SIZE);
+
+	// BakeGradient writes GRADIENT_SIZE 8-bit gradient opacities to out. Returns false if the
+	// function is fully opaque everywhere, in which case the transfer function only depends on
+	// the density.
+	static bool BakeGradient(vtkPiecewiseFunction *gradient, uint8_t *out);
+
+	// GetNodes copies the nodes of both functions
+	static void GetNodes(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, TransferFunctionNodes &nodes);
+
+	// GetChangedRange returns the range of entries which may differ between two bakes of the
+	// given nodes. Returns false if no entry can be affected.
+	static bool GetChangedRange(const TransferFunctionNodes &previous, const TransferFunctionNodes &current, int &first, int &count);
+
+	// Benchmark compares Bake and BakeReference with a typical transfer function, prints both
+	// times and returns false if their results differ
+	static bool Benchmark(FILE *out);
+};
+
+#endif // TRANSFER_FUNCTION_BAKER_H
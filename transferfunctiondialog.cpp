@@ -13,8 +13,10 @@ TransferFunctionDialog::TransferFunctionDialog(QWidget *parent, Qt::WindowFlags
 	this->setLayout(mainlayout);
 
 	this->transferfunctionwidget = new QmitkTransferFunctionWidget();
-	this->transferfunctionwidget->SetGradientOpacityFunctionEnabled(false);
-	this->transferfunctionwidget->ShowGradientOpacityFunction(false);
+	// The gradient opacity makes a two-dimensional transfer function, used by the density and
+	// gradient magnitude classification
+	this->transferfunctionwidget->SetGradientOpacityFunctionEnabled(true);
+	this->transferfunctionwidget->ShowGradientOpacityFunction(true);
 	mainlayout->addWidget(this->transferfunctionwidget);
 
 	mainlayout->addSpacing(24);
@@ -0,0 +1,275 @@
+#include "transferfunctionfile.h"
+#include "transferfunctionbaker.h"
+#include "transferfunctionlibrary.h"
+
+// Standard library
+#include <stdint.h>
+#include <string.h>
+
+// Qt
+#include <QFile>
+
+static const char MAGIC[8] = { 'V', 'R', 'D', 'T', 'F', 'L', 'I', 'B' };
+static const uint32_t FORMAT_VERSION = 1;
+
+// Rows start at a multiple of this
+static const uint64_t ROW_ALIGNMENT = 4096;
+
+static const int NAME_LENGTH = 60;
+
+// Set in the table entries of transfer functions with a gradient opacity row
+static const uint32_t FLAG_GRADIENT = 1;
+
+// All values are stored in little-endian byte order
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+
+	// Entries per row and scalar value of the first entry
+	uint32_t entries;
+	int32_t offset;
+
+	// The gradient opacity rows of all transfer functions directly follow the table, if any
+	// transfer function has the gradient flag
+	uint64_t tableoffset;
+	uint64_t rowoffset;
+};
+
+struct TableEntry
+{
+	// UTF-8, zero terminated
+	char name[NAME_LENGTH];
+	uint32_t flags;
+};
+
+static_assert(sizeof(Header) == 40, "Unexpected header padding");
+static_assert(sizeof(TableEntry) == 64, "Unexpected table entry padding");
+
+static bool IsBigEndian()
+{
+	const uint16_t one = 1;
+	return *(const unsigned char*)&one == 0;
+}
+
+static uint32_t Swap32(uint32_t value)
+{
+	return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+}
+
+static uint64_t Swap64(uint64_t value)
+{
+	return ((uint64_t)Swap32((uint32_t)value) << 32) | Swap32((uint32_t)(value >> 32));
+}
+
+// ConvertHeader converts a header between the byte order of the file and the one of the host.
+// Rows are bytes and need no conversion.
+static void ConvertHeader(Header &header)
+{
+	if (!IsBigEndian())
+		return;
+
+	header.version = Swap32(header.version);
+	header.count = Swap32(header.count);
+	header.entries = Swap32(header.entries);
+	header.offset = (int32_t)Swap32((uint32_t)header.offset);
+	header.tableoffset = Swap64(header.tableoffset);
+	header.rowoffset = Swap64(header.rowoffset);
+}
+
+static uint32_t ConvertFlags(uint32_t flags)
+{
+	return IsBigEndian() ? Swap32(flags) : flags;
+}
+
+TransferFunctionFile::~TransferFunctionFile()
+{
+}
+
+bool TransferFunctionFile::Map(const QString &filename, std::vector<Entry> &entries, std::shared_ptr<const void> &mapping, QString &error)
+{
+	std::shared_ptr<QFile> file = std::make_shared<QFile>(filename);
+
+	if (!file->open(QIODevice::ReadOnly))
+	{
+		error = file->errorString();
+		return false;
+	}
+
+	const qint64 size = file->size();
+
+	if (size < (qint64)sizeof(Header))
+	{
+		error = QObject::tr("The file is too short");
+		return false;
+	}
+
+	// The mapping is released when the last reference to the file is gone
+	const unsigned char *data = file->map(0, size);
+	if (data == NULL)
+	{
+		error = file->errorString();
+		return false;
+	}
+
+	Header header;
+	memcpy(&header, data, sizeof(Header));
+	ConvertHeader(header);
+
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		error = QObject::tr("The file is not a transfer function library");
+		return false;
+	}
+
+	if (header.version != FORMAT_VERSION)
+	{
+		error = QObject::tr("Unsupported format version %1").arg(header.version);
+		return false;
+	}
+
+	if (header.entries != TransferFunctionBaker::SIZE || header.offset != TransferFunctionBaker::OFFSET)
+	{
+		error = QObject::tr("Transfer functions are expected to have %1 entries starting at %2")
+			.arg(TransferFunctionBaker::SIZE).arg(TransferFunctionBaker::OFFSET);
+		return false;
+	}
+
+	const uint64_t tablesize = (uint64_t)header.count * sizeof(TableEntry);
+	const uint64_t rowsize = (uint64_t)header.count * TransferFunctionLibrary::ROW_BYTES;
+
+	if (header.tableoffset > (uint64_t)size || tablesize > (uint64_t)size - header.tableoffset ||
+		header.rowoffset > (uint64_t)size || rowsize > (uint64_t)size - header.rowoffset)
+	{
+		error = QObject::tr("The file is truncated");
+		return false;
+	}
+
+	// Rows are used in place, so they must be aligned like the writer places them
+	if (header.rowoffset % ROW_ALIGNMENT != 0)
+	{
+		error = QObject::tr("The transfer function rows are misaligned");
+		return false;
+	}
+
+	const uint64_t gradientoffset = header.tableoffset + tablesize;
+	const uint64_t gradientsize = (uint64_t)header.count * TransferFunctionLibrary::GRADIENT_BYTES;
+
+	entries.resize(header.count);
+
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		TableEntry tableentry;
+		memcpy(&tableentry, data + header.tableoffset + i * sizeof(TableEntry), sizeof(TableEntry));
+		tableentry.flags = ConvertFlags(tableentry.flags);
+
+		entries[i].row = data + header.rowoffset + (uint64_t)i * TransferFunctionLibrary::ROW_BYTES;
+		entries[i].gradient = NULL;
+		entries[i].name.assign(tableentry.name, strnlen(tableentry.name, NAME_LENGTH));
+
+		if ((tableentry.flags & FLAG_GRADIENT) == 0)
+			continue;
+
+		if (gradientsize > (uint64_t)size - gradientoffset)
+		{
+			error = QObject::tr("The file is truncated");
+			return false;
+		}
+
+		entries[i].gradient = data + gradientoffset + (uint64_t)i * TransferFunctionLibrary::GRADIENT_BYTES;
+	}
+
+	mapping = file;
+
+	return true;
+}
+
+bool TransferFunctionFile::Write(const QString &filename, const TransferFunctionLibrary &library, QString &error)
+{
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = FORMAT_VERSION;
+	header.count = library.GetCount();
+	header.entries = TransferFunctionBaker::SIZE;
+	header.offset = TransferFunctionBaker::OFFSET;
+	header.tableoffset = sizeof(Header);
+
+	// Gradient opacity rows are written for all transfer functions or none
+	bool gradients = false;
+	for (int i = 0; i < library.GetCount(); i++)
+		gradients = gradients || library.GetGradient(i) != NULL;
+
+	uint64_t tableend = header.tableoffset + (uint64_t)header.count * sizeof(TableEntry);
+	if (gradients)
+		tableend += (uint64_t)header.count * TransferFunctionLibrary::GRADIENT_BYTES;
+
+	header.rowoffset = (tableend + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+
+	// The rows may be mapped from the file that is being replaced, so the new file is written
+	// separately and only renamed when complete
+	const QString tmpname = filename + ".tmp";
+	QFile file(tmpname);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		error = file.errorString();
+		return false;
+	}
+
+	const uint64_t rowoffset = header.rowoffset;
+	ConvertHeader(header);
+
+	bool ok = file.write((const char*)&header, sizeof(Header)) == sizeof(Header);
+
+	for (int i = 0; ok && i < library.GetCount(); i++)
+	{
+		TableEntry tableentry;
+		memset(&tableentry, 0, sizeof(TableEntry));
+
+		const std::string &name = library.GetName(i);
+		memcpy(tableentry.name, name.data(), name.size() < NAME_LENGTH ? name.size() : NAME_LENGTH - 1);
+
+		if (library.GetGradient(i) != NULL)
+			tableentry.flags = ConvertFlags(FLAG_GRADIENT);
+
+		ok = file.write((const char*)&tableentry, sizeof(TableEntry)) == sizeof(TableEntry);
+	}
+
+	const QByteArray opaque(TransferFunctionLibrary::GRADIENT_BYTES, (char)255);
+
+	for (int i = 0; ok && gradients && i < library.GetCount(); i++)
+	{
+		const unsigned char *gradient = library.GetGradient(i);
+		const char *bytes = gradient != NULL ? (const char*)gradient : opaque.constData();
+
+		ok = file.write(bytes, TransferFunctionLibrary::GRADIENT_BYTES) == TransferFunctionLibrary::GRADIENT_BYTES;
+	}
+
+	if (ok)
+	{
+		const QByteArray padding((int)(rowoffset - tableend), '\0');
+		ok = file.write(padding) == padding.size();
+	}
+
+	for (int i = 0; ok && i < library.GetCount(); i++)
+		ok = file.write((const char*)library.GetRow(i), TransferFunctionLibrary::ROW_BYTES) == TransferFunctionLibrary::ROW_BYTES;
+
+	if (!ok)
+	{
+		error = file.errorString();
+		file.remove();
+		return false;
+	}
+
+	file.close();
+
+	if ((QFile::exists(filename) && !QFile::remove(filename)) || !QFile::rename(tmpname, filename))
+	{
+		error = QObject::tr("Couldn't replace %1").arg(filename);
+		QFile::remove(tmpname);
+		return false;
+	}
+
+	return true;
+}
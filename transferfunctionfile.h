@@ -0,0 +1,39 @@
+#ifndef TRANSFER_FUNCTION_FILE_H
+#define TRANSFER_FUNCTION_FILE_H
+
+#include <QString>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class TransferFunctionLibrary;
+
+// TransferFunctionFile reads and writes transfer function libraries in the binary .vtf format.
+// A file starts with a header, followed by a table with the name of every transfer function, the
+// gradient opacity rows of two-dimensional transfer functions and the raw premultiplied RGBA8
+// rows in the library format. Rows start at a page boundary, so a mapped file is used as it is
+// without decoding or copying.
+class TransferFunctionFile
+{
+	virtual ~TransferFunctionFile() = 0;
+
+public:
+	struct Entry
+	{
+		const unsigned char *row;
+
+		// NULL for a one-dimensional transfer function
+		const unsigned char *gradient;
+
+		std::string name;
+	};
+
+	// Map maps a file into memory and lists its transfer functions. The rows stay valid as long
+	// as a reference to mapping is held. On failure, error describes the problem.
+	static bool Map(const QString &filename, std::vector<Entry> &entries, std::shared_ptr<const void> &mapping, QString &error);
+
+	static bool Write(const QString &filename, const TransferFunctionLibrary &library, QString &error);
+};
+
+#endif // TRANSFER_FUNCTION_FILE_H
@@ -0,0 +1,184 @@
+#include "transferfunctionlibrary.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+// Number of content changes kept in the journal
+static const size_t MAX_JOURNAL = 256;
+
+TransferFunctionLibrary::TransferFunctionLibrary() : version(0), journalstart(0)
+{
+}
+
+void TransferFunctionLibrary::Record(int slot)
+{
+	this->version++;
+
+	Change change = { this->version, slot };
+	this->journal.push_back(change);
+
+	if (this->journal.size() > MAX_JOURNAL)
+	{
+		this->journalstart = this->journal.front().version;
+		this->journal.pop_front();
+	}
+}
+
+int TransferFunctionLibrary::Insert(Entry entry)
+{
+	int slot;
+
+	if (!this->freeslots.empty())
+	{
+		slot = this->freeslots.back();
+		this->freeslots.pop_back();
+		this->entries[slot] = std::move(entry);
+	}
+	else
+	{
+		slot = (int)this->entries.size();
+		this->entries.push_back(std::move(entry));
+	}
+
+	this->order.push_back(slot);
+	Record(slot);
+
+	return slot;
+}
+
+int TransferFunctionLibrary::Add(Row row, Row gradient)
+{
+	Entry entry;
+	entry.data = row.get();
+	entry.gradient = gradient.get();
+	entry.row = std::move(row);
+	entry.gradientrow = std::move(gradient);
+
+	return Insert(std::move(entry));
+}
+
+int TransferFunctionLibrary::Add(const unsigned char *row, const unsigned char *gradient)
+{
+	Row copy(new unsigned char[ROW_BYTES]);
+	memcpy(copy.get(), row, ROW_BYTES);
+
+	Row gradientcopy;
+
+	if (gradient != NULL)
+	{
+		gradientcopy.reset(new unsigned char[GRADIENT_BYTES]);
+		memcpy(gradientcopy.get(), gradient, GRADIENT_BYTES);
+	}
+
+	return Add(std::move(copy), std::move(gradientcopy));
+}
+
+int TransferFunctionLibrary::AddShared(const unsigned char *row, const unsigned char *gradient, const std::shared_ptr<const void> &owner)
+{
+	Entry entry;
+	entry.owner = owner;
+	entry.data = row;
+	entry.gradient = gradient;
+
+	return Insert(std::move(entry));
+}
+
+void TransferFunctionLibrary::Remove(int position)
+{
+	const int slot = this->order[position];
+
+	this->entries[slot] = Entry();
+	this->entries[slot].data = NULL;
+	this->entries[slot].gradient = NULL;
+	this->freeslots.push_back(slot);
+	this->order.erase(this->order.begin() + position);
+
+	// The slot keeps its old contents wherever they have been copied, it just isn't
+	// referenced anymore. Only the order changes.
+	this->version++;
+}
+
+void TransferFunctionLibrary::Move(int from, int to)
+{
+	if (from == to)
+		return;
+
+	const int slot = this->order[from];
+	this->order.erase(this->order.begin() + from);
+	this->order.insert(this->order.begin() + to, slot);
+
+	this->version++;
+}
+
+void TransferFunctionLibrary::Clear()
+{
+	this->entries.clear();
+	this->freeslots.clear();
+	this->order.clear();
+
+	this->version++;
+}
+
+int TransferFunctionLibrary::GetCount() const
+{
+	return (int)this->order.size();
+}
+
+const unsigned char *TransferFunctionLibrary::GetRow(int position) const
+{
+	return this->entries[this->order[position]].data;
+}
+
+int TransferFunctionLibrary::GetSlot(int position) const
+{
+	return this->order[position];
+}
+
+const unsigned char *TransferFunctionLibrary::GetGradient(int position) const
+{
+	return this->entries[this->order[position]].gradient;
+}
+
+const std::string &TransferFunctionLibrary::GetName(int position) const
+{
+	return this->entries[this->order[position]].name;
+}
+
+void TransferFunctionLibrary::SetName(int position, const std::string &name)
+{
+	this->entries[this->order[position]].name = name;
+}
+
+int TransferFunctionLibrary::GetSlotCount() const
+{
+	return (int)this->entries.size();
+}
+
+const unsigned char *TransferFunctionLibrary::GetSlotRow(int slot) const
+{
+	return this->entries[slot].data;
+}
+
+const unsigned char *TransferFunctionLibrary::GetSlotGradient(int slot) const
+{
+	return this->entries[slot].gradient;
+}
+
+unsigned int TransferFunctionLibrary::GetVersion() const
+{
+	return this->version;
+}
+
+bool TransferFunctionLibrary::GetChangedSlots(unsigned int since, std::vector<int> &changed) const
+{
+	changed.clear();
+
+	if (since < this->journalstart)
+		return false;
+
+	for (auto it = this->journal.rbegin(); it != this->journal.rend() && it->version > since; ++it)
+		changed.push_back(it->slot);
+
+	return true;
+}
@@ -0,0 +1,103 @@
+#ifndef TRANSFER_FUNCTION_LIBRARY_H
+#define TRANSFER_FUNCTION_LIBRARY_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// TransferFunctionLibrary holds the 4096-entry premultiplied RGBA8 rows of all transfer
+// functions. Each row lives in a slot which keeps its number and address until the row is
+// removed, so adding, removing or reordering rows never copies other rows. Positions give
+// the order in which rows are shown and blended. Rows are either owned by the library or
+// refer to memory that is kept alive by a shared owner, e.g. a mapped file.
+// Two-dimensional transfer functions have an additional gradient opacity row, which scales the
+// opacity of all entries by the gradient magnitude at the sample.
+// Every change increments the version. Content changes are also recorded in a journal, so
+// users of the rows (e.g. GPU copies indexed by slot) can update just the affected slots.
+class TransferFunctionLibrary
+{
+	typedef std::unique_ptr<unsigned char[]> Row;
+
+	struct Entry
+	{
+		Row row;
+		Row gradientrow;
+		std::shared_ptr<const void> owner;
+		const unsigned char *data;
+		const unsigned char *gradient;
+		std::string name;
+	};
+
+	struct Change
+	{
+		unsigned int version;
+		int slot;
+	};
+
+	// Entries of free slots have no data
+	std::vector<Entry> entries;
+	std::vector<int> freeslots;
+
+	// Slot of each position
+	std::vector<int> order;
+
+	unsigned int version;
+
+	// Slots whose contents changed, oldest first. Versions up to journalstart are no longer
+	// covered.
+	std::deque<Change> journal;
+	unsigned int journalstart;
+
+	int Insert(Entry entry);
+	void Record(int slot);
+
+public:
+	// Bytes of a single row and of a gradient opacity row
+	static const int ROW_BYTES = 4096 * 4;
+	static const int GRADIENT_BYTES = 256;
+
+	TransferFunctionLibrary();
+
+	// Add appends a row and an optional gradient opacity row and returns its slot. The first
+	// version takes ownership of the rows, the second one copies them.
+	int Add(Row row, Row gradient = Row());
+	int Add(const unsigned char *row, const unsigned char *gradient = NULL);
+
+	// AddShared appends rows without copying them. The rows stay valid as long as owner does.
+	int AddShared(const unsigned char *row, const unsigned char *gradient, const std::shared_ptr<const void> &owner);
+
+	void Remove(int position);
+
+	// Move takes the row at position from out and inserts it at position to
+	void Move(int from, int to);
+
+	void Clear();
+
+	// Number of rows
+	int GetCount() const;
+
+	const unsigned char *GetRow(int position) const;
+	int GetSlot(int position) const;
+
+	// Gradient opacity row, or NULL for a one-dimensional transfer function
+	const unsigned char *GetGradient(int position) const;
+
+	// Names are only informational and don't change the version
+	const std::string &GetName(int position) const;
+	void SetName(int position, const std::string &name);
+
+	// Slots in use have an index below the slot count. Free slots return NULL.
+	int GetSlotCount() const;
+	const unsigned char *GetSlotRow(int slot) const;
+	const unsigned char *GetSlotGradient(int slot) const;
+
+	unsigned int GetVersion() const;
+
+	// GetChangedSlots stores the slots whose contents changed after the given version. The same
+	// slot may be listed more than once. Returns false if the journal doesn't reach back that
+	// far, in which case all slots have to be treated as changed.
+	bool GetChangedSlots(unsigned int since, std::vector<int> &changed) const;
+};
+
+#endif // TRANSFER_FUNCTION_LIBRARY_H
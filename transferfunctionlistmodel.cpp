@@ -0,0 +1,322 @@
+#include "transferfunctionlistmodel.h"
+#include "transferfunctionlibrary.h"
+
+// Standard library
+#include <string.h>
+
+// Qt
+#include <QDataStream>
+#include <QMimeData>
+#include <QRunnable>
+
+// Number of transfer function entries covered by a thumbnail column
+static const int ENTRIES_PER_COLUMN = 4096 / TransferFunctionListModel::THUMBNAIL_WIDTH;
+
+// Bars are 2 * alpha + 1 pixels high at full resolution, which is 512 pixels high
+static const double BAR_SCALE = TransferFunctionListModel::THUMBNAIL_HEIGHT / 512.0;
+
+static const char *MIME_TYPE = "application/x-transferfunction-position";
+
+namespace
+{
+	// Renders a copy of a row, so the row may be removed from the library in the meantime
+	class ThumbnailTask : public QRunnable
+	{
+		QObject *receiver;
+		int slot;
+		int generation;
+		std::unique_ptr<unsigned char[]> row;
+
+	public:
+		ThumbnailTask(QObject *receiver, int slot, int generation, const unsigned char *row)
+			: receiver(receiver), slot(slot), generation(generation), row(new unsigned char[TransferFunctionLibrary::ROW_BYTES])
+		{
+			memcpy(this->row.get(), row, TransferFunctionLibrary::ROW_BYTES);
+		}
+
+		void run()
+		{
+			QImage image = TransferFunctionListModel::RenderThumbnail(this->row.get());
+
+			QMetaObject::invokeMethod(this->receiver, "ThumbnailReady", Qt::QueuedConnection,
+				Q_ARG(int, this->slot), Q_ARG(int, this->generation), Q_ARG(QImage, image));
+		}
+	};
+}
+
+TransferFunctionListModel::TransferFunctionListModel(const std::shared_ptr<TransferFunctionLibrary> &library, QObject *parent)
+	: QAbstractListModel(parent), library(library)
+{
+}
+
+TransferFunctionListModel::~TransferFunctionListModel()
+{
+	// Results posted by the remaining tasks are discarded together with this object
+	this->pool.clear();
+	this->pool.waitForDone();
+}
+
+QImage TransferFunctionListModel::RenderThumbnail(const unsigned char *row)
+{
+	QImage image(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, QImage::Format_ARGB32_Premultiplied);
+
+	for (int x = 0; x < THUMBNAIL_WIDTH; x++)
+	{
+		const unsigned char *entries = row + x * ENTRIES_PER_COLUMN * 4;
+
+		// Unpremultiplied colors and bar heights of the covered entries
+		int colors[ENTRIES_PER_COLUMN][3];
+		double heights[ENTRIES_PER_COLUMN];
+
+		for (int i = 0; i < ENTRIES_PER_COLUMN; i++)
+		{
+			const int a = entries[i * 4 + 3];
+
+			if (a == 0)
+			{
+				heights[i] = 0.0;
+				continue;
+			}
+
+			colors[i][0] = (255 * entries[i * 4 + 0]) / a;
+			colors[i][1] = (255 * entries[i * 4 + 1]) / a;
+			colors[i][2] = (255 * entries[i * 4 + 2]) / a;
+			heights[i] = (2 * a + 1) * BAR_SCALE;
+		}
+
+		for (int y = 0; y < THUMBNAIL_HEIGHT; y++)
+		{
+			// Distance of the top of this pixel from the bottom of the image
+			const double top = THUMBNAIL_HEIGHT - y;
+
+			double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+			for (int i = 0; i < ENTRIES_PER_COLUMN; i++)
+			{
+				double coverage = heights[i] - (top - 1.0);
+
+				if (coverage <= 0.0)
+					continue;
+				if (coverage > 1.0)
+					coverage = 1.0;
+
+				sum[0] += coverage * colors[i][0];
+				sum[1] += coverage * colors[i][1];
+				sum[2] += coverage * colors[i][2];
+				sum[3] += coverage * 255.0;
+			}
+
+			QRgb *pixel = (QRgb*)image.scanLine(y) + x;
+			*pixel = qRgba((int)(sum[0] / ENTRIES_PER_COLUMN + 0.5), (int)(sum[1] / ENTRIES_PER_COLUMN + 0.5),
+				(int)(sum[2] / ENTRIES_PER_COLUMN + 0.5), (int)(sum[3] / ENTRIES_PER_COLUMN + 0.5));
+		}
+	}
+
+	return image;
+}
+
+void TransferFunctionListModel::RequestThumbnail(int slot) const
+{
+	if (this->pending[slot] == this->generations[slot])
+		return;
+
+	TransferFunctionListModel *self = const_cast<TransferFunctionListModel*>(this);
+	self->pending[slot] = this->generations[slot];
+
+	this->pool.start(new ThumbnailTask(self, slot, this->generations[slot], this->library->GetSlotRow(slot)));
+}
+
+void TransferFunctionListModel::InvalidateSlot(int slot)
+{
+	if (slot >= (int)this->generations.size())
+	{
+		this->thumbnails.resize(slot + 1);
+		this->generations.resize(slot + 1, 0);
+		this->pending.resize(slot + 1, 0);
+	}
+
+	this->thumbnails[slot] = QPixmap();
+	this->generations[slot]++;
+}
+
+void TransferFunctionListModel::ThumbnailReady(int slot, int generation, QImage image)
+{
+	if (slot >= (int)this->generations.size() || generation != this->generations[slot])
+		return;
+
+	this->thumbnails[slot] = QPixmap::fromImage(image);
+
+	for (int i = 0; i < this->library->GetCount(); i++)
+	{
+		if (this->library->GetSlot(i) == slot)
+		{
+			QModelIndex changed = index(i);
+			emit dataChanged(changed, changed);
+			break;
+		}
+	}
+}
+
+void TransferFunctionListModel::Add(std::unique_ptr<unsigned char[]> row, std::unique_ptr<unsigned char[]> gradient)
+{
+	const int position = this->library->GetCount();
+
+	beginInsertRows(QModelIndex(), position, position);
+	InvalidateSlot(this->library->Add(std::move(row), std::move(gradient)));
+	endInsertRows();
+}
+
+void TransferFunctionListModel::Append(const unsigned char *rows, int count, int stride)
+{
+	if (count < 1)
+		return;
+
+	const int position = this->library->GetCount();
+
+	beginInsertRows(QModelIndex(), position, position + count - 1);
+	for (int i = 0; i < count; i++)
+		InvalidateSlot(this->library->Add(rows + i * stride));
+	endInsertRows();
+}
+
+void TransferFunctionListModel::Append(const std::vector<TransferFunctionFile::Entry> &entries, const std::shared_ptr<const void> &mapping)
+{
+	if (entries.empty())
+		return;
+
+	const int position = this->library->GetCount();
+
+	beginInsertRows(QModelIndex(), position, position + (int)entries.size() - 1);
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		InvalidateSlot(this->library->AddShared(entries[i].row, entries[i].gradient, mapping));
+		this->library->SetName(position + (int)i, entries[i].name);
+	}
+	endInsertRows();
+}
+
+void TransferFunctionListModel::Remove(int position)
+{
+	beginRemoveRows(QModelIndex(), position, position);
+	InvalidateSlot(this->library->GetSlot(position));
+	this->library->Remove(position);
+	endRemoveRows();
+}
+
+void TransferFunctionListModel::Clear()
+{
+	beginResetModel();
+	for (size_t i = 0; i < this->generations.size(); i++)
+		InvalidateSlot((int)i);
+	this->library->Clear();
+	endResetModel();
+}
+
+int TransferFunctionListModel::rowCount(const QModelIndex &parent) const
+{
+	if (parent.isValid())
+		return 0;
+
+	return this->library->GetCount();
+}
+
+QVariant TransferFunctionListModel::data(const QModelIndex &index, int role) const
+{
+	if (!index.isValid() || index.row() >= this->library->GetCount())
+		return QVariant();
+
+	if (role == Qt::SizeHintRole)
+		return QSize(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+
+	// Names are shown as tool tips, so they don't take space from the thumbnails
+	if (role == Qt::ToolTipRole || role == Qt::EditRole)
+		return QString::fromUtf8(this->library->GetName(index.row()).c_str());
+
+	if (role != Qt::DecorationRole)
+		return QVariant();
+
+	const int slot = this->library->GetSlot(index.row());
+
+	if (this->thumbnails[slot].isNull())
+	{
+		RequestThumbnail(slot);
+		return QVariant();
+	}
+
+	return this->thumbnails[slot];
+}
+
+bool TransferFunctionListModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+	if (!index.isValid() || index.row() >= this->library->GetCount() || role != Qt::EditRole)
+		return false;
+
+	this->library->SetName(index.row(), value.toString().toUtf8().constData());
+	emit dataChanged(index, index);
+
+	return true;
+}
+
+Qt::ItemFlags TransferFunctionListModel::flags(const QModelIndex &index) const
+{
+	// Dropping onto an item isn't supported, only between items
+	if (!index.isValid())
+		return Qt::ItemIsDropEnabled;
+
+	return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsDragEnabled | Qt::ItemIsEditable;
+}
+
+Qt::DropActions TransferFunctionListModel::supportedDropActions() const
+{
+	return Qt::MoveAction;
+}
+
+QStringList TransferFunctionListModel::mimeTypes() const
+{
+	return QStringList(MIME_TYPE);
+}
+
+QMimeData *TransferFunctionListModel::mimeData(const QModelIndexList &indexes) const
+{
+	if (indexes.size() != 1)
+		return NULL;
+
+	QByteArray encoded;
+	QDataStream stream(&encoded, QIODevice::WriteOnly);
+	stream << indexes.first().row();
+
+	QMimeData *data = new QMimeData();
+	data->setData(MIME_TYPE, encoded);
+
+	return data;
+}
+
+bool TransferFunctionListModel::dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int, const QModelIndex &parent)
+{
+	if (action != Qt::MoveAction || !data->hasFormat(MIME_TYPE))
+		return false;
+
+	QByteArray encoded = data->data(MIME_TYPE);
+	QDataStream stream(&encoded, QIODevice::ReadOnly);
+
+	int from = -1;
+	stream >> from;
+
+	const int count = this->library->GetCount();
+	if (from < 0 || from >= count)
+		return false;
+
+	// row is the position in front of which the item has been dropped
+	if (row < 0)
+		row = parent.isValid() ? parent.row() : count;
+
+	if (!beginMoveRows(QModelIndex(), from, from, QModelIndex(), row))
+		return false;
+
+	this->library->Move(from, row > from ? row - 1 : row);
+	endMoveRows();
+
+	// The rows have been moved already, returning false keeps the view from removing the
+	// dragged item afterwards
+	return false;
+}
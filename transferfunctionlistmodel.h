@@ -0,0 +1,77 @@
+#ifndef TRANSFER_FUNCTION_LIST_MODEL_H
+#define TRANSFER_FUNCTION_LIST_MODEL_H
+
+#include <QAbstractListModel>
+#include <QImage>
+#include <QPixmap>
+#include <QThreadPool>
+
+#include "transferfunctionfile.h"
+
+#include <memory>
+#include <vector>
+
+class TransferFunctionLibrary;
+
+// TransferFunctionListModel presents the rows of a TransferFunctionLibrary to a list view.
+// Thumbnails are only rendered once the view asks for them, i.e. for visible rows, and the
+// rendering runs on a thread pool. Changes to the library have to be made through the model
+// so attached views stay in sync.
+class TransferFunctionListModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+	std::shared_ptr<TransferFunctionLibrary> library;
+
+	// Thumbnails by library slot. A null pixmap hasn't been rendered yet.
+	std::vector<QPixmap> thumbnails;
+
+	// Incremented whenever a slot is given new contents, so results of outdated requests are
+	// dropped. pending holds the generation a request is in flight for, or 0.
+	std::vector<int> generations;
+	std::vector<int> pending;
+
+	mutable QThreadPool pool;
+
+	void RequestThumbnail(int slot) const;
+	void InvalidateSlot(int slot);
+
+private slots:
+	void ThumbnailReady(int slot, int generation, QImage image);
+
+public:
+	static const int THUMBNAIL_WIDTH = 256;
+	static const int THUMBNAIL_HEIGHT = 32;
+
+	explicit TransferFunctionListModel(const std::shared_ptr<TransferFunctionLibrary> &library, QObject *parent = 0);
+	~TransferFunctionListModel();
+
+	// RenderThumbnail draws the opacity of a library row as bars colored by the unpremultiplied
+	// color, box-filtering the entries covered by each pixel
+	static QImage RenderThumbnail(const unsigned char *row);
+
+	// Add takes ownership of a row of TransferFunctionLibrary::ROW_BYTES bytes and an optional
+	// gradient opacity row and appends them
+	void Add(std::unique_ptr<unsigned char[]> row, std::unique_ptr<unsigned char[]> gradient = std::unique_ptr<unsigned char[]>());
+
+	// Append copies count rows which are stride bytes apart
+	void Append(const unsigned char *rows, int count, int stride);
+
+	// Append adds the rows of a mapped file without copying them
+	void Append(const std::vector<TransferFunctionFile::Entry> &entries, const std::shared_ptr<const void> &mapping);
+
+	void Remove(int position);
+	void Clear();
+
+	int rowCount(const QModelIndex &parent = QModelIndex()) const;
+	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+	bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole);
+	Qt::ItemFlags flags(const QModelIndex &index) const;
+
+	Qt::DropActions supportedDropActions() const;
+	QStringList mimeTypes() const;
+	QMimeData *mimeData(const QModelIndexList &indexes) const;
+	bool dropMimeData(const QMimeData *data, Qt::DropAction action, int row, int column, const QModelIndex &parent);
+};
+
+#endif // TRANSFER_FUNCTION_LIST_MODEL_H
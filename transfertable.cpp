@@ -0,0 +1,85 @@
+#include "transfertable.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+unsigned int TransferTable::nextversion = 1;
+
+TransferTable::TransferTable(int width, int height, int linespertask) : width(width), height(height), linespertask(linespertask), nrrows(0)
+{
+}
+
+TransferTable::~TransferTable()
+{
+}
+
+bool TransferTable::IsBuilt(int row, uint64_t hash)
+{
+	return hash == this->hashes[row];
+}
+
+bool TransferTable::BuildRow(int row, uint64_t hash, const std::function<void(int first, int last, unsigned char *table)> &build)
+{
+	if (IsBuilt(row, hash))
+		return false;
+
+	unsigned char *table = &this->tables[(size_t)row * this->width * this->height * 4];
+
+	const int nrtasks = (this->height + this->linespertask - 1) / this->linespertask;
+
+	ParallelFor(nrtasks, [&](int task)
+	{
+		const int first = task * this->linespertask;
+		const int last = std::min(first + this->linespertask, this->height);
+
+		build(first, last, table);
+	});
+
+	this->hashes[row] = hash;
+	this->versions[row] = nextversion++;
+
+	return true;
+}
+
+void TransferTable::SetRowCount(int nrrows)
+{
+	if (nrrows == this->nrrows)
+		return;
+
+	const size_t tablebytes = (size_t)this->width * this->height * 4;
+
+	this->tables.resize(tablebytes * nrrows, 0);
+	this->hashes.resize(nrrows, 0);
+
+	// Empty tables get a version of their own as well
+	for (int i = this->nrrows; i < nrrows; i++)
+		this->versions.push_back(nextversion++);
+
+	this->versions.resize(nrrows);
+	this->nrrows = nrrows;
+}
+
+int TransferTable::GetWidth()
+{
+	return this->width;
+}
+
+int TransferTable::GetHeight()
+{
+	return this->height;
+}
+
+int TransferTable::GetRowCount()
+{
+	return this->nrrows;
+}
+
+const unsigned char *TransferTable::GetTable(int row)
+{
+	return &this->tables[(size_t)row * this->width * this->height * 4];
+}
+
+unsigned int TransferTable::GetVersion(int row)
+{
+	return this->versions[row];
+}
@@ -0,0 +1,62 @@
+#ifndef TRANSFER_TABLE_H
+#define TRANSFER_TABLE_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+// TransferTable holds one RGBA8 table of width * height entries per row of a transfer function
+// library. Tables are derived from the rows by subclasses and rebuilt only when the hash of
+// their sources changes. Each table has a version, so copies on the GPU can be updated
+// selectively.
+class TransferTable
+{
+	int width;
+	int height;
+	int linespertask;
+	int nrrows;
+
+	std::vector<unsigned char> tables;
+	std::vector<uint64_t> hashes;
+	std::vector<unsigned int> versions;
+
+	static unsigned int nextversion;
+
+protected:
+	// Tables are built in parallel work items of linespertask lines each
+	TransferTable(int width, int height, int linespertask);
+
+	// IsBuilt returns true if the table of the given row has been built from sources with the
+	// given hash
+	bool IsBuilt(int row, uint64_t hash);
+
+	// BuildRow rebuilds the table of the given row unless it has been built from sources with
+	// the same hash. build fills the lines [first, last) of the table and is called using all
+	// available hardware threads. Returns true if the table has been rebuilt.
+	bool BuildRow(int row, uint64_t hash, const std::function<void(int first, int last, unsigned char *table)> &build);
+
+public:
+	virtual ~TransferTable();
+
+	// SetRowCount resizes the table to the given number of rows. Existing tables are kept,
+	// new ones are empty until they are built by UpdateRow.
+	void SetRowCount(int nrrows);
+
+	// UpdateRow rebuilds a single table if its source rows have changed. A NULL gradient row is
+	// fully opaque for all gradient magnitudes. Returns true if the table has been rebuilt.
+	virtual bool UpdateRow(int row, const unsigned char *data, const unsigned char *gradient) = 0;
+
+	int GetWidth();
+	int GetHeight();
+	int GetRowCount();
+
+	// GetTable returns width * height RGBA8 entries for the given row
+	const unsigned char *GetTable(int row);
+
+	// GetVersion returns a number which changes whenever the contents of a table change.
+	// Versions are unique across all instances and never 0.
+	unsigned int GetVersion(int row);
+};
+
+#endif // TRANSFER_TABLE_H
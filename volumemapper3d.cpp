@@ -1,6 +1,20 @@
 #include "volumemapper3d.h"
+#include "allocationcounter.h"
+#include "classifiedvolume.h"
+#include "glstatecache.h"
+#include "gputimer.h"
+#include "gradienttransfertable.h"
 #include "opengl.h"
+#include "preintegrationtable.h"
+#include "profiler.h"
+#include "programcache.h"
+#include "rendertargetpool.h"
+#include "resolutioncontroller.h"
+#include "rollingstatistics.h"
 #include "shaderprogram.h"
+#include "shadingtable.h"
+#include "transferfunctionlibrary.h"
+#include "transferfunctionbaker.h"
 
 #include <mitkBaseRenderer.h>
 #include <mitkGeometry3D.h>
@@ -20,18 +34,130 @@
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include <QFile>
 #include <QByteArray>
 
+// Ray step length used with pre-integrated classification, relative to the default step
+static const float PREINTEGRATION_STEP_FACTOR = 3.0f;
+
+// Progressive refinement renders each frame with a coarser step and accumulates this many
+// jittered frames before it stops
+static const float PROGRESSIVE_STEP_FACTOR = 2.0f;
+static const int PROGRESSIVE_FRAMES = 16;
+
+// Smallest supported render scale
+static const float MIN_RENDER_SCALE = 0.25f;
+
+// Samples written by one capture pass, one per color attachment (see fragment-raycast.glsl)
+static const int CAPTURE_LAYERS = 8;
+
+// Largest number of cached samples per ray, the number of array layers every implementation
+// supports
+static const int MAX_CACHED_SAMPLES = 256;
+
+// Bytes of classified bricks uploaded per frame at most. Larger updates are spread over
+// several frames, so changing the transfer function doesn't stall rendering.
+static const size_t MAX_CLASSIFIED_UPLOAD = 16 * 1024 * 1024;
+
+// Nesting depth of SaveFramebufferState within a single frame
+static const int MAX_FRAMEBUFFER_SAVES = 4;
+
+// Frames after the first one which may still allocate, e.g. to build timers or shader variants.
+// Later frames are expected to make no heap allocations in Paint.
+static const int ALLOCATION_WARMUP_FRAMES = 16;
+
+// Attribute locations, fixed by layout qualifiers in all vertex shaders
+static const int ATTRIBUTE_VERTEX = 0;
+static const int ATTRIBUTE_UV = 1;
+
+// Binding point of the FrameData uniform block
+static const unsigned int FRAME_DATA_BINDING = 0;
+
+// Texture units of all samplers, assigned once per program
+static const struct
+{
+	const char *name;
+	int unit;
+} SAMPLER_UNITS[] = {
+	{ "volume", 0 },
+	{ "image", 0 },
+	{ "frontfaces", 1 },
+	{ "backfaces", 2 },
+	{ "transfer", 3 },
+	{ "classified", 3 },
+	{ "preintegration", 4 },
+	{ "transfer2d", 5 },
+	{ "transferrows", 6 },
+	{ "samples", 7 },
+	{ "shading", 8 }
+};
+
+static const int NR_SAMPLER_UNITS = sizeof(SAMPLER_UNITS) / sizeof(SAMPLER_UNITS[0]);
+
+// Contents of the FrameData uniform block, laid out according to std140
+struct FrameData
+{
+	float view[16];
+	float projection[16];
+	float invertedmodel[16];
+	float camerapos[4];
+	float transferindex;
+	float padding;
+	float targetscale[2];
+};
+
+// Extra bits in the tags of volume pass measurements, above the shader features
+static const unsigned int TAG_MOTION = 1u << 31;
+static const unsigned int TAG_REDUCED = 1u << 30;
+
+// Preprocessor symbols of the ray casting shader features
+static const struct
+{
+	unsigned int feature;
+	const char *name;
+} FEATURE_NAMES[] = {
+	{ VolumeMapper3D::FEATURE_LIGHTING, "LIGHTING" },
+	{ VolumeMapper3D::FEATURE_MODULATION, "MODULATION" },
+	{ VolumeMapper3D::FEATURE_FORWARD_GRADIENT, "FORWARD_GRADIENT" },
+	{ VolumeMapper3D::FEATURE_PREINTEGRATED, "PREINTEGRATED" },
+	{ VolumeMapper3D::FEATURE_BLEND_TRANSFER, "BLEND_TRANSFER" },
+	{ VolumeMapper3D::FEATURE_SKIP_EMPTY, "SKIP_EMPTY" },
+	{ VolumeMapper3D::FEATURE_JITTER, "JITTER" },
+	{ VolumeMapper3D::FEATURE_CLASSIFY_2D, "CLASSIFY_2D" },
+	{ VolumeMapper3D::FEATURE_FAN_OUT_2, "FAN_OUT_2" },
+	{ VolumeMapper3D::FEATURE_FAN_OUT_3, "FAN_OUT_3" },
+	{ VolumeMapper3D::FEATURE_FAN_OUT_4, "FAN_OUT_4" },
+	{ VolumeMapper3D::FEATURE_CAPTURE_SAMPLES, "CAPTURE_SAMPLES" },
+	{ VolumeMapper3D::FEATURE_CACHED_SAMPLES, "CACHED_SAMPLES" },
+	{ VolumeMapper3D::FEATURE_PRECLASSIFIED, "PRECLASSIFIED" },
+	{ VolumeMapper3D::FEATURE_SHADING_TABLE, "SHADING_TABLE" }
+};
+
+static const unsigned int FAN_OUT_FEATURES = VolumeMapper3D::FEATURE_FAN_OUT_2 | VolumeMapper3D::FEATURE_FAN_OUT_3 | VolumeMapper3D::FEATURE_FAN_OUT_4;
+
+static const int NR_FEATURES = sizeof(FEATURE_NAMES) / sizeof(FEATURE_NAMES[0]);
+
 VolumeMapper3D::LocalStorage::LocalStorage()
 {
 	window = NULL;
-	windowsize[0] = 0;
-	windowsize[1] = 0;
+	glstate = new GLStateCache();
+	errormode = -1;
 
 	raysetupprogram = NULL;
 	raycastprogram = NULL;
+	raycastfeatures = 0;
+	raycasttimer = NULL;
+	setuptimer = NULL;
+	uploadtimer = NULL;
+	compositetimer = NULL;
+	setuptime = 0.0f;
+	compositeprogram = NULL;
+	upsampleprogram = NULL;
 	
 	vertexarray = 0;
 	
@@ -39,30 +165,76 @@ VolumeMapper3D::LocalStorage::LocalStorage()
 	boundsindexbuffer = 0;
 
 	quadvertexbuffer = 0;
+	framedatabuffer = 0;
 
-	frontbackfacefbos[0] = 0;
-	frontbackfacefbos[1] = 0;
-
-	frontbackfacetextures[0] = 0;
-	frontbackfacetextures[1] = 0;
+	targets = new RenderTargetPool(glstate, NR_RENDER_TARGETS);
+	accumulatedframes = 0;
+	memset(&framestate, 0, sizeof(framestate));
 
 	volumetexture = 0;
 	volumetimestamp = 0;
+	boundstimestamp = 0;
+	uploads = 0;
+	uploadbytes = 0;
 
 	transfertexture = 0;
+	transferversion = 0;
+
+	preintegrationtexture = 0;
+	preintegrationlayers = 0;
+
+	gradienttexture = 0;
+	gradientlayers = 0;
+
+	fanoutframebuffer = 0;
+	fanoutoutputs = 0;
+	fanouttexture = 0;
+	fanoutversion = 0;
+
+	samplecache = 0;
+	samplecacheframebuffer = 0;
+	memset(samplecachesize, 0, sizeof(samplecachesize));
+	samplecachevalid = false;
+	memset(&samplecachekey, 0, sizeof(samplecachekey));
+	memset(&lastcachekey, 0, sizeof(lastcachekey));
+
+	classifiedtexture = 0;
+	memset(classifieddim, 0, sizeof(classifieddim));
+	classifiedmissing = 0;
+	classifieduploads = 0;
+	classifiedsettled = false;
+
+	shadingtable = NULL;
+	shadingtexture = 0;
+	shadingcompared = false;
+
+	fbostack.reserve(MAX_FRAMEBUFFER_SAVES * 2);
 }
 
 VolumeMapper3D::LocalStorage::~LocalStorage()
 {
+	delete this->glstate;
+	delete this->shadingtable;
+
 	if (this->window == NULL)
 	{
+		delete this->targets;
 		return;
 	}
 
 	this->window->MakeCurrent();
 
 	delete this->raysetupprogram;
-	delete this->raycastprogram;
+
+	for (auto it = this->raycastprograms.begin(); it != this->raycastprograms.end(); ++it)
+		delete it->second;
+
+	delete this->raycasttimer;
+	delete this->setuptimer;
+	delete this->uploadtimer;
+	delete this->compositetimer;
+	delete this->compositeprogram;
+	delete this->upsampleprogram;
 
 	glDeleteBuffers(1, &this->boundsindexbuffer);
 	glDeleteBuffers(1, &this->boundsvertexbuffer);
@@ -70,17 +242,60 @@ VolumeMapper3D::LocalStorage::~LocalStorage()
 
 	glDeleteVertexArrays(1, &this->vertexarray);
 
-	glDeleteFramebuffers(2, &this->frontbackfacefbos[0]);
-	glDeleteTextures(2, &this->frontbackfacetextures[0]);
+	glDeleteBuffers(1, &this->framedatabuffer);
+
+	this->targets->Destroy();
+	delete this->targets;
 
 	glDeleteTextures(1, &this->volumetexture);
 
 	glDeleteTextures(1, &this->transfertexture);
+
+	glDeleteTextures(1, &this->preintegrationtexture);
+
+	glDeleteTextures(1, &this->gradienttexture);
+
+	glDeleteFramebuffers(1, &this->fanoutframebuffer);
+	glDeleteTextures(1, &this->fanouttexture);
+
+	glDeleteFramebuffers(1, &this->samplecacheframebuffer);
+	glDeleteTextures(1, &this->samplecache);
+
+	glDeleteTextures(1, &this->classifiedtexture);
+
+	glDeleteTextures(1, &this->shadingtexture);
 }
 
-VolumeMapper3D::VolumeMapper3D() : glinit(false), pendingtexture(NULL),
-displaymode(DisplayMode::PREVIEW), transferindex(0.0f)
+VolumeMapper3D::VolumeMapper3D() : glinit(false),
+displaymode(DisplayMode::PREVIEW), transferindex(0.0f), classificationmode(ClassificationMode::POINT),
+gradientmethod(GradientMethod::CENTRAL), lighting(true), modulation(true), emptyspaceskipping(false), shadingmode(ShadingMode::EXACT), libraryversion(0), nrtransferrows(0), transferversion(0), blendedtransfer(4096 * 4, 0.0f), blendedversion(0), blendedindex(0.0f),
+blendedrows(0), blendedfirst(0), blendedcount(4096), previewrow(4096 * 4, 0), previewvalid(false), previewversion(0), previewtableversion(0), previewgradient(TransferFunctionBaker::GRADIENT_SIZE, 255), previewhasgradient(false),
+previewgradientversion(0), previewgradienttableversion(0), preintegrationlibrary(NULL), preintegrationversion(0), gradientlibrary(NULL), gradientlibraryversion(0), fanout(1), fanoutcount(0), fanoutbase(0), fanoutrows(0), fanoutversion(0), samplecachebudget(0), classifiedvolume(NULL), classifiedtimestamp(0), classifiedmode(DisplayMode::PREVIEW), classifiedversion(0),
+classifiedposition(0), classifiedmodulation(false), firstframe(false), builtprograms(0), cachedprograms(0),
+programbuildtime(0.0), progressive(false), converged(false), renderscale(1.0f), frametimebudget(0.0f), passtiminglog(0), passtimingframes(0)
 {
+	this->resolutioncontroller = new ResolutionController();
+
+	for (int i = 0; i < NR_RENDER_PASSES; i++)
+		this->passtimes[i] = new RollingStatistics();
+
+	this->startuptimer.start();
+
+	memset(&this->glcalls, 0, sizeof(this->glcalls));
+
+	memset(&this->shadingdifference, 0, sizeof(this->shadingdifference));
+
+	memset(&this->modelstamp, 0, sizeof(this->modelstamp));
+	this->modelvalid = false;
+
+	this->preintegration[DisplayMode::PREVIEW] = new PreIntegrationTable();
+	this->preintegration[DisplayMode::DEMO] = new PreIntegrationTable();
+
+	this->gradienttables[DisplayMode::PREVIEW] = new GradientTransferTable();
+	this->gradienttables[DisplayMode::DEMO] = new GradientTransferTable();
+
+	memset(this->fanoutslots, 0, sizeof(this->fanoutslots));
+
 	if (!OpenGL::Init())
 	{
 		fputs("Can't initialize OpenGL: Volume rendering disabled\n", stderr);
@@ -97,8 +312,15 @@ displaymode(DisplayMode::PREVIEW), transferindex(0.0f)
 
 VolumeMapper3D::~VolumeMapper3D()
 {
-	if (this->pendingtexture != NULL)
-		this->pendingtexture->Delete();
+	delete this->preintegration[DisplayMode::PREVIEW];
+	delete this->preintegration[DisplayMode::DEMO];
+	delete this->gradienttables[DisplayMode::PREVIEW];
+	delete this->gradienttables[DisplayMode::DEMO];
+	delete this->classifiedvolume;
+	delete this->resolutioncontroller;
+
+	for (int i = 0; i < NR_RENDER_PASSES; i++)
+		delete this->passtimes[i];
 }
 
 void VolumeMapper3D::SaveWindow(mitk::BaseRenderer *renderer)
@@ -111,7 +333,7 @@ void VolumeMapper3D::SaveWindow(mitk::BaseRenderer *renderer)
 	}
 }
 
-void VolumeMapper3D::UpdateShaderProgram(mitk::BaseRenderer *renderer, ShaderProgram *&program, const char *vfile, const char *ffile)
+void VolumeMapper3D::UpdateShaderProgram(mitk::BaseRenderer *renderer, ShaderProgram *&program, const char *vfile, const char *ffile, const char *defines)
 {
 	// Try to load shader files from the local file system first. This is useful for debugging, because
 	// shaders can be loaded and unloaded without recompiling the application. If the specified filenames
@@ -123,6 +345,9 @@ void VolumeMapper3D::UpdateShaderProgram(mitk::BaseRenderer *renderer, ShaderPro
 	if (program != NULL)
 		return;
 
+	QElapsedTimer timer;
+	timer.start();
+
 	char vbuffer[MAX_PATH + 1];
 	char fbuffer[MAX_PATH + 1];
 
@@ -155,17 +380,320 @@ void VolumeMapper3D::UpdateShaderProgram(mitk::BaseRenderer *renderer, ShaderPro
 
 	program = new ShaderProgram();
 
-	if (!program->Build(vsrc, fsrc))
+	// Restore the program from the binary cache if possible. Fall back to compiling the
+	// sources if there is no cache entry or the driver rejects it.
+	if (ProgramCache::Load(program, vsrc, fsrc, defines))
+	{
+		this->cachedprograms++;
+	}
+	else if (program->Build(vsrc, fsrc, defines))
+	{
+		ProgramCache::Store(program, vsrc, fsrc, defines);
+	}
+	else
 	{
 		fprintf(stderr, "Can't build shader program, log follows:\n%s\n", program->GetBuildLog());
 		delete program;
 		program = NULL;
 	}
 
+	if (program != NULL)
+		InitializeProgram(renderer, program);
+
+	this->builtprograms++;
+	this->programbuildtime += (double)timer.nsecsElapsed() / 1.0e6;
+
 	delete[]vsrc;
 	delete[]fsrc;
 }
 
+void VolumeMapper3D::InitializeProgram(mitk::BaseRenderer *renderer, ShaderProgram *program)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	storage->glstate->UseProgram(program->GetProgram());
+
+	// Samplers always use the same texture units
+	for (int i = 0; i < NR_SAMPLER_UNITS; i++)
+	{
+		const int location = program->GetUniformLocation(SAMPLER_UNITS[i].name);
+
+		if (location >= 0)
+			glUniform1i(location, SAMPLER_UNITS[i].unit);
+	}
+
+	program->BindUniformBlock("FrameData", FRAME_DATA_BINDING);
+	CheckGLError();
+}
+
+unsigned int VolumeMapper3D::GetRaycastFeatures(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	unsigned int features = 0;
+
+	const int outputs = GetFanOutCount();
+
+	// Colors and modulation are part of the classified volume. Lighting would need gradients,
+	// so it is left out as well.
+	if (this->classificationmode == ClassificationMode::PRECLASSIFIED && storage->classifiedtexture != 0 && storage->classifiedmissing == 0)
+	{
+		features = FEATURE_PRECLASSIFIED;
+
+		if (this->progressive)
+			features |= FEATURE_JITTER;
+
+		return features;
+	}
+
+	if (this->lighting)
+		features |= FEATURE_LIGHTING;
+
+	if (this->modulation)
+		features |= FEATURE_MODULATION;
+
+	if (this->shadingmode != ShadingMode::EXACT && (features & (FEATURE_LIGHTING | FEATURE_MODULATION)))
+		features |= FEATURE_SHADING_TABLE;
+
+	if (this->gradientmethod == GradientMethod::FORWARD)
+		features |= FEATURE_FORWARD_GRADIENT;
+
+	if (this->classificationmode == ClassificationMode::PREINTEGRATED || this->classificationmode == ClassificationMode::DENSITY_GRADIENT)
+	{
+		if (this->classificationmode == ClassificationMode::PREINTEGRATED)
+			features |= FEATURE_PREINTEGRATED;
+		else
+			features |= FEATURE_CLASSIFY_2D;
+
+		// Point classification is blended on the CPU. Pre-integrated and two-dimensional
+		// tables only need to be blended while the animation is between two transfer functions.
+		// Side-by-side views show whole transfer functions only.
+		const bool between = this->transferindex != floorf(this->transferindex);
+
+		if (this->displaymode == DisplayMode::DEMO && this->nrtransferrows > 1 && between && outputs == 1)
+			features |= FEATURE_BLEND_TRANSFER;
+	}
+
+	if (outputs == 2)
+		features |= FEATURE_FAN_OUT_2;
+	else if (outputs == 3)
+		features |= FEATURE_FAN_OUT_3;
+	else if (outputs > 3)
+		features |= FEATURE_FAN_OUT_4;
+
+	if (this->emptyspaceskipping)
+		features |= FEATURE_SKIP_EMPTY;
+
+	if (this->progressive)
+		features |= FEATURE_JITTER;
+
+	return features;
+}
+
+ShaderProgram *VolumeMapper3D::GetRaycastProgram(mitk::BaseRenderer *renderer, unsigned int features)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	ShaderProgram *&program = storage->raycastprograms[features];
+
+	if (program == NULL)
+	{
+		char defines[512] = "";
+
+		for (int i = 0; i < NR_FEATURES; i++)
+		{
+			if ((features & FEATURE_NAMES[i].feature) == 0)
+				continue;
+
+			strcat(defines, "#define ");
+			strcat(defines, FEATURE_NAMES[i].name);
+			strcat(defines, "\n");
+		}
+
+		// Keep line numbers in the build log in sync with the source file
+		strcat(defines, "#line 2\n");
+
+		UpdateShaderProgram(renderer, program, "vertex-raycast.glsl", "fragment-raycast.glsl", defines);
+
+		// GPU times arrive frames later, when adding the entry could allocate in a steady frame
+		VariantTime &time = this->varianttimes[features];
+		time.total = 0.0;
+		time.frames = 0;
+	}
+
+	return program;
+}
+
+void VolumeMapper3D::UpdateRaycastProgram(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	const unsigned int features = GetRaycastFeatures(renderer);
+
+	storage->raycastprogram = GetRaycastProgram(renderer, features);
+	storage->raycastfeatures = features;
+}
+
+void VolumeMapper3D::CollectGpuTimes(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	if (storage->raycasttimer == NULL)
+		storage->raycasttimer = new GpuTimer();
+
+	if (storage->setuptimer == NULL)
+		storage->setuptimer = new GpuTimer();
+
+	if (storage->uploadtimer == NULL)
+		storage->uploadtimer = new GpuTimer();
+
+	if (storage->compositetimer == NULL)
+		storage->compositetimer = new GpuTimer();
+
+	float ms;
+	unsigned int tag;
+
+	while (storage->uploadtimer->Poll(ms))
+		this->passtimes[PASS_UPLOAD]->Add(ms);
+
+	while (storage->setuptimer->Poll(ms))
+	{
+		storage->setuptime = ms;
+		this->passtimes[PASS_RAY_SETUP]->Add(ms);
+	}
+
+	while (storage->compositetimer->Poll(ms))
+		this->passtimes[PASS_COMPOSITE]->Add(ms);
+
+	while (storage->raycasttimer->Poll(ms, &tag))
+	{
+		this->passtimes[PASS_VOLUME]->Add(ms);
+
+		// Frames in motion drive the resolution controller
+		if ((tag & TAG_MOTION) && this->frametimebudget > 0.0f)
+			this->resolutioncontroller->Update(storage->setuptime + ms);
+
+		// Compare shader variants at full quality only
+		if (tag & TAG_REDUCED)
+			continue;
+
+		// Entries are created with the program, so looking them up never allocates
+		auto it = this->varianttimes.find(tag & ~TAG_MOTION);
+		if (it == this->varianttimes.end())
+			continue;
+
+		it->second.total += ms;
+		it->second.frames++;
+	}
+}
+
+bool VolumeMapper3D::GetPassTiming(RenderPass pass, PassTiming &timing)
+{
+	RollingStatistics *statistics = this->passtimes[pass];
+
+	timing.samples = statistics->GetCount();
+	timing.min = statistics->GetMin();
+	timing.average = statistics->GetAverage();
+	timing.p99 = statistics->GetPercentile(0.99f);
+
+	return timing.samples > 0;
+}
+
+void VolumeMapper3D::SetPassTimingLogInterval(int frames)
+{
+	this->passtiminglog = frames;
+}
+
+void VolumeMapper3D::LogPassTimings()
+{
+	static const char *names[NR_RENDER_PASSES] = { "upload", "ray setup", "volume", "composite" };
+
+	if (this->passtiminglog <= 0 || ++this->passtimingframes < this->passtiminglog)
+		return;
+
+	this->passtimingframes = 0;
+
+	printf("GPU ms (min/avg/p99):");
+
+	for (int i = 0; i < NR_RENDER_PASSES; i++)
+	{
+		PassTiming timing;
+
+		if (GetPassTiming((RenderPass)i, timing))
+			printf(" %s %.3f/%.3f/%.3f", names[i], timing.min, timing.average, timing.p99);
+	}
+
+	printf("\n");
+}
+
+void VolumeMapper3D::PrintShaderVariantTimes(FILE *out)
+{
+	if (this->varianttimes.empty())
+		return;
+
+	fprintf(out, "%-64s %8s %10s\n", "Shader variant", "Frames", "Avg. ms");
+
+	for (auto it = this->varianttimes.begin(); it != this->varianttimes.end(); ++it)
+	{
+		// Variants which have been built but not measured yet
+		if (it->second.frames == 0)
+			continue;
+
+		char name[512] = "";
+
+		for (int i = 0; i < NR_FEATURES; i++)
+		{
+			if ((it->first & FEATURE_NAMES[i].feature) == 0)
+				continue;
+
+			if (name[0] != 0)
+				strcat(name, " ");
+
+			strcat(name, FEATURE_NAMES[i].name);
+		}
+
+		if (name[0] == 0)
+			strcpy(name, "(no features)");
+
+		fprintf(out, "%-64s %8d %10.3f\n", name, it->second.frames, it->second.total / it->second.frames);
+	}
+}
+
+void VolumeMapper3D::PrintGLStateStatistics(FILE *out)
+{
+	if (this->glcalls.frames == 0)
+		return;
+
+	const double frames = (double)this->glcalls.frames;
+
+	fprintf(out, "GL state calls per frame: %.1f issued, %.1f skipped as redundant, %.1f queries\n",
+		this->glcalls.issued / frames, this->glcalls.skipped / frames, this->glcalls.queries / frames);
+	fprintf(out, "Uploads per frame: %.2f (%.1f KB)\n",
+		this->glcalls.uploads / frames, this->glcalls.uploadbytes / frames / 1024.0);
+	fprintf(out, "CPU time per frame: %.3f ms\n", this->glcalls.painttime / frames);
+
+	if (this->glcalls.allocationframes > 0)
+		fprintf(out, "Heap allocations in Paint: %lld in %d frames after warm-up\n", this->glcalls.allocations, this->glcalls.allocationframes);
+}
+
+int VolumeMapper3D::GetAllocationCheckFrames()
+{
+	return this->glcalls.allocationframes;
+}
+
+void VolumeMapper3D::PrintShadingDifference(FILE *out)
+{
+	const ShadingDifference &difference = this->shadingdifference;
+
+	if (difference.frames == 0)
+		return;
+
+	const double values = (double)difference.values;
+
+	fprintf(out, "Shading table vs. exact shading in %d frames: mean difference %.3f, RMS %.3f, max %d (8 bit levels), %.3f%% of values off by more than 2\n",
+		difference.frames, difference.sum / values, sqrt(difference.sumsquares / values), difference.max, 100.0 * difference.above / values);
+}
+
 char *VolumeMapper3D::ReadFile(const char *path, size_t *size)
 {
 	QFile file(path);
@@ -196,6 +724,15 @@ char *VolumeMapper3D::ReadFile(const char *path, size_t *size)
 
 void VolumeMapper3D::UpdateBoundsVertexBuffer(mitk::BaseRenderer *renderer)
 {
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	// Both geometries share the ITK clock, so the newer one tells if anything has changed
+	mitk::Image *image = dynamic_cast<mitk::Image*>(GetDataNode()->GetData());
+	const uint64_t mtime = std::max<uint64_t>(image->GetTimeGeometry()->GetMTime(), image->GetGeometry()->GetMTime());
+
+	if (storage->boundsvertexbuffer != 0 && storage->boundstimestamp == mtime)
+		return;
+
 	float bounds[6];
 	GetBounds(GetDataNode(), bounds);
 
@@ -210,13 +747,14 @@ void VolumeMapper3D::UpdateBoundsVertexBuffer(mitk::BaseRenderer *renderer)
 		bounds[0], bounds[3], bounds[4]  // 7: LTB
 	};
 
-	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
-
 	if (storage->boundsvertexbuffer == 0)
 		glGenBuffers(1, &storage->boundsvertexbuffer);
 
-	glBindBuffer(GL_ARRAY_BUFFER, storage->boundsvertexbuffer);
+	storage->glstate->BindBuffer(GL_ARRAY_BUFFER, storage->boundsvertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(float), corners, GL_STATIC_DRAW);
+	CountUpload(renderer, 24 * sizeof(float));
+
+	storage->boundstimestamp = mtime;
 
 	if (storage->boundsindexbuffer == 0)
 	{
@@ -238,8 +776,9 @@ void VolumeMapper3D::UpdateBoundsVertexBuffer(mitk::BaseRenderer *renderer)
 			0, 2, 3
 		};
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, storage->boundsindexbuffer);
+		storage->glstate->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, storage->boundsindexbuffer);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, 36 * sizeof(uint8_t), indices, GL_STATIC_DRAW);
+		CountUpload(renderer, 36 * sizeof(uint8_t));
 	}
 }
 
@@ -247,8 +786,11 @@ void VolumeMapper3D::UpdateQuadVertexBuffer(mitk::BaseRenderer *renderer)
 {
 	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
-	if (storage->quadvertexbuffer == 0)
-		glGenBuffers(1, &storage->quadvertexbuffer);
+	// The quad never changes
+	if (storage->quadvertexbuffer != 0)
+		return;
+
+	glGenBuffers(1, &storage->quadvertexbuffer);
 
 	float data[] = {
 		1.0, 1.0, // vertex position
@@ -261,56 +803,69 @@ void VolumeMapper3D::UpdateQuadVertexBuffer(mitk::BaseRenderer *renderer)
 		0.0, 0.0
 	};
 
-	glBindBuffer(GL_ARRAY_BUFFER, storage->quadvertexbuffer);
+	storage->glstate->BindBuffer(GL_ARRAY_BUFFER, storage->quadvertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, 16 * sizeof(float), data, GL_STATIC_DRAW);
+	CountUpload(renderer, 16 * sizeof(float));
 }
 
 void VolumeMapper3D::UpdateFramebufferObjects(mitk::BaseRenderer *renderer)
 {
 	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
-	const int w = renderer->GetSizeX();
-	const int h = renderer->GetSizeY();
-
 	SaveFramebufferState(renderer);
 
-	for (int i = 0; i < 2; i++)
-	{
-		if (!glIsFramebuffer(storage->frontbackfacefbos[i]))
-		{
-			glGenFramebuffers(1, &storage->frontbackfacefbos[i]);
-			CheckGLError();
-		}
+	// Rendering covers the lower left part of each target, which is only reallocated
+	// once the window leaves its size bucket
+	int size[2];
+	GetRenderSize(renderer, size);
+	storage->targets->Resize(size[0], size[1]);
 
-		if (!glIsTexture(storage->frontbackfacetextures[i]))
-		{
-			glGenTextures(1, &storage->frontbackfacetextures[i]);
-			CheckGLError();
-		}
+	storage->targets->Acquire(TARGET_FRONTFACES);
+	storage->targets->Acquire(TARGET_BACKFACES);
 
-		if (w == storage->windowsize[0] && h == storage->windowsize[1])
-			continue;
+	// The accumulation buffer is only needed for progressive refinement
+	if (this->progressive)
+		storage->targets->Acquire(TARGET_ACCUMULATION);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, storage->frontbackfacefbos[i]);
+	// Reduced resolution frames use the lower left part of the window area
+	if (this->renderscale < 1.0f || this->frametimebudget > 0.0f)
+		storage->targets->Acquire(TARGET_REDUCED);
 
-		glBindTexture(GL_TEXTURE_2D, storage->frontbackfacetextures[i]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (this->shadingmode == ShadingMode::COMPARE)
+		storage->targets->Acquire(TARGET_COMPARE);
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-		CheckGLError();
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, storage->frontbackfacetextures[i], 0);
+	const int outputs = GetFanOutCount();
+
+	for (int i = 0; i < outputs && outputs > 1; i++)
+		storage->targets->Acquire(TARGET_FAN_OUT + i);
+
+	// Reallocating a target keeps its texture name, so the attachments only change with the
+	// number of views
+	if (outputs > 1 && storage->fanoutoutputs != outputs)
+	{
+		if (storage->fanoutframebuffer == 0)
+			glGenFramebuffers(1, &storage->fanoutframebuffer);
+
+		storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->fanoutframebuffer);
+
+		GLenum buffers[MAX_FAN_OUT];
+
+		for (int i = 0; i < MAX_FAN_OUT; i++)
+		{
+			const unsigned int texture = i < outputs ? storage->targets->GetTexture(TARGET_FAN_OUT + i) : 0;
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, texture, 0);
+			buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+		}
+
+		glDrawBuffers(outputs, buffers);
 		CheckGLError();
 
 		const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 		if (status != GL_FRAMEBUFFER_COMPLETE)
-			fprintf(stderr, "Warning: FBO status is 0x%x\n", status);
-	}
+			fprintf(stderr, "Warning: Fan-out FBO status is 0x%x\n", status);
 
-	storage->windowsize[0] = w;
-	storage->windowsize[1] = h;
+		storage->fanoutoutputs = outputs;
+	}
 
 	RestoreFramebufferState(renderer);
 }
@@ -319,13 +874,8 @@ void VolumeMapper3D::SaveFramebufferState(mitk::BaseRenderer *renderer)
 {
 	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
-	int drawbuffer;
-	int readbuffer;
-	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, (GLint*)&drawbuffer);
-	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, (GLint*)&readbuffer);
-
-	storage->fbostack.push_back(drawbuffer);
-	storage->fbostack.push_back(readbuffer);
+	storage->fbostack.push_back(storage->glstate->GetDrawFramebuffer());
+	storage->fbostack.push_back(storage->glstate->GetReadFramebuffer());
 }
 
 void VolumeMapper3D::RestoreFramebufferState(mitk::BaseRenderer *renderer)
@@ -340,8 +890,8 @@ void VolumeMapper3D::RestoreFramebufferState(mitk::BaseRenderer *renderer)
 		int readbuffer = storage->fbostack[size - 1];
 		storage->fbostack.resize(size - 2);
 
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawbuffer);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, readbuffer);
+		storage->glstate->BindFramebuffer(GL_DRAW_FRAMEBUFFER, drawbuffer);
+		storage->glstate->BindFramebuffer(GL_READ_FRAMEBUFFER, readbuffer);
 	}
 }
 
@@ -364,7 +914,10 @@ void VolumeMapper3D::GetProjectionMatrix(mitk::BaseRenderer *renderer, float mat
 {
 	vtkCamera *camera = renderer->GetVtkRenderer()->GetActiveCamera();
 
-	double aspect = (double)renderer->GetSizeX() / (double)renderer->GetSizeY();
+	int size[2];
+	GetRenderSize(renderer, size);
+
+	double aspect = (double)size[0] / (double)size[1];
 
 	double cliprange[2];
 	camera->GetClippingRange(cliprange);
@@ -389,20 +942,32 @@ void VolumeMapper3D::GetInverseModelMatrix(mitk::BaseRenderer *renderer, float m
 {
 	mitk::DataNode *node = GetDataNode();
 	mitk::Geometry3D *geo = node->GetData()->GetGeometry(renderer->GetTimeStep());
+	vtkMatrix4x4 *mxmodel = geo->GetVtkTransform()->GetMatrix();
 
-	vtkMatrix4x4 *mxmodel = vtkMatrix4x4::New();
-	mxmodel->DeepCopy(geo->GetVtkTransform()->GetMatrix());
-	mxmodel->Invert();
+	ModelStamp stamp;
+	memset(&stamp, 0, sizeof(stamp));
+	stamp.geometry = geo;
+	stamp.geometrytime = geo->GetMTime();
+	stamp.transformtime = mxmodel->GetMTime();
 
-	for (int i = 0; i < 4; i++)
+	if (!this->modelvalid || memcmp(&stamp, &this->modelstamp, sizeof(stamp)) != 0)
 	{
-		for (int j = 0; j < 4; j++)
+		double inverse[16];
+		vtkMatrix4x4::Invert(&mxmodel->Element[0][0], inverse);
+
+		for (int i = 0; i < 4; i++)
 		{
-			matrix[j * 4 + i] = (float)mxmodel->Element[i][j];
+			for (int j = 0; j < 4; j++)
+			{
+				this->inversemodel[j * 4 + i] = (float)inverse[i * 4 + j];
+			}
 		}
+
+		this->modelstamp = stamp;
+		this->modelvalid = true;
 	}
 
-	mxmodel->Delete();
+	memcpy(matrix, this->inversemodel, sizeof(this->inversemodel));
 }
 
 void VolumeMapper3D::GetCameraPosition(mitk::BaseRenderer *renderer, float position[3])
@@ -453,13 +1018,13 @@ void VolumeMapper3D::UpdateVolumeTexture(mitk::BaseRenderer *renderer)
 		return;
 	}
 
-	if (!glIsTexture(storage->volumetexture))
+	if (storage->volumetexture == 0)
 	{
 		glGenTextures(1, &storage->volumetexture);
 		CheckGLError();
 	}
 
-	glBindTexture(GL_TEXTURE_3D, storage->volumetexture);
+	storage->glstate->BindTexture(GL_TEXTURE_3D, storage->volumetexture);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -474,8 +1039,9 @@ void VolumeMapper3D::UpdateVolumeTexture(mitk::BaseRenderer *renderer)
 
 	glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, dim[0], dim[1], dim[2], 0, GL_RED, GL_FLOAT, normalized->GetScalarPointer());
 	CheckGLError();
+	CountUpload(renderer, (size_t)dim[0] * dim[1] * dim[2] * sizeof(float));
 
-	glBindTexture(GL_TEXTURE_3D, 0);
+	storage->glstate->BindTexture(GL_TEXTURE_3D, 0);
 
 	normalized->Delete();
 
@@ -484,6 +1050,8 @@ void VolumeMapper3D::UpdateVolumeTexture(mitk::BaseRenderer *renderer)
 
 vtkImageData *VolumeMapper3D::CreateNormalizedVolume(vtkImageData *input)
 {
+	PROFILE_SCOPE("CreateNormalizedVolume");
+
 	vtkSmartPointer<vtkImageCast> floatfilter = vtkSmartPointer<vtkImageCast>::New();
 	floatfilter->SetOutputScalarTypeToFloat();
 	floatfilter->SetInputData(input);
@@ -508,30 +1076,40 @@ vtkImageData *VolumeMapper3D::CreateNormalizedVolume(vtkImageData *input)
 	return output;
 }
 
-void VolumeMapper3D::SetTransferTexture(int nrfunctions, unsigned char *data)
+void VolumeMapper3D::SetTransferFunctionLibrary(const std::shared_ptr<TransferFunctionLibrary> &library)
 {
 	SetTransferFunctionIndex(0.0f);
 
-	if (this->pendingtexture != NULL)
+	if (library != this->library)
 	{
-		this->pendingtexture->Delete();
-		this->pendingtexture = NULL;
+		this->library = library;
+		this->transferversion++;
 	}
 
-	if (nrfunctions < 1)
+	UpdateTransferRows();
+}
+
+void VolumeMapper3D::UpdateTransferRows()
+{
+	if (this->library == NULL)
+	{
+		this->nrtransferrows = 0;
 		return;
+	}
 
-	this->pendingtexture = vtkImageData::New();
-	this->pendingtexture->SetDimensions(4096, nrfunctions, 1);
-	this->pendingtexture->SetOrigin(0, 0, 0);
-	this->pendingtexture->SetSpacing(1, 1, 1);
-	this->pendingtexture->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+	if (this->library->GetVersion() != this->libraryversion)
+	{
+		this->libraryversion = this->library->GetVersion();
+		this->transferversion++;
+	}
 
-	memcpy(this->pendingtexture->GetScalarPointer(), data, 4096 * 4 * nrfunctions);
+	this->nrtransferrows = this->library->GetCount();
 }
 
 void VolumeMapper3D::UpdateTransferTexture(mitk::BaseRenderer *renderer)
 {
+	UpdateTransferRows();
+
 	if (this->displaymode == DisplayMode::DEMO)
 		UpdateTransferTextureDemo(renderer);
 	else
@@ -540,238 +1118,1591 @@ void VolumeMapper3D::UpdateTransferTexture(mitk::BaseRenderer *renderer)
 	
 void VolumeMapper3D::UpdateTransferTextureDemo(mitk::BaseRenderer *renderer)
 {
-	if (this->pendingtexture == NULL)
-		return;
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
-	int dim[3];
-	this->pendingtexture->GetDimensions(dim);
+	if (this->classificationmode == ClassificationMode::PREINTEGRATED)
+	{
+		PreIntegrationTable *table = this->preintegration[DisplayMode::DEMO];
 
-	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+		UpdateTableRows(table, this->preintegrationlibrary, this->preintegrationversion);
+		UpdateTableTexture(renderer, table, storage->preintegrationtexture, storage->preintegrationlayers, storage->preintegrationversions);
+	}
+	else if (this->classificationmode == ClassificationMode::DENSITY_GRADIENT)
+	{
+		GradientTransferTable *table = this->gradienttables[DisplayMode::DEMO];
 
-	if (!glIsTexture(storage->transfertexture))
-		glGenTextures(1, &storage->transfertexture);
+		UpdateTableRows(table, this->gradientlibrary, this->gradientlibraryversion);
+		UpdateTableTexture(renderer, table, storage->gradienttexture, storage->gradientlayers, storage->gradientversions);
+	}
 
-	glBindTexture(GL_TEXTURE_2D, storage->transfertexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	if (this->nrtransferrows < 1)
+		return;
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, dim[0], dim[1], 0, GL_RGBA, GL_UNSIGNED_BYTE, this->pendingtexture->GetScalarPointer());
-	CheckGLError();
+	// Side-by-side views use the rows as they are
+	if (GetFanOutCount() > 1)
+	{
+		UpdateFanOutRows();
 
-	this->pendingtexture->Delete();
-	this->pendingtexture = NULL;
+		if (this->classificationmode == ClassificationMode::POINT)
+			UploadFanOutTexture(renderer);
+
+		return;
+	}
+
+	BlendTransferFunctions();
+	UploadTransferTexture(renderer);
 }
 
-void VolumeMapper3D::UpdateTransferTexturePreview(mitk::BaseRenderer *renderer)
+bool VolumeMapper3D::CollectChangedSlots(const TransferFunctionLibrary *seenlibrary, unsigned int seenversion)
 {
-	mitk::TransferFunctionProperty::Pointer property = mitk::TransferFunctionProperty::New();
-	if (!this->GetDataNode()->GetProperty(property, "TransferFunction"))
-		return;
+	const TransferFunctionLibrary *library = this->library.get();
 
-	vtkColorTransferFunction *color = property->GetValue()->GetColorTransferFunction();
-	vtkPiecewiseFunction *opacity = property->GetValue()->GetScalarOpacityFunction();
+	if (library == seenlibrary && library->GetVersion() == seenversion)
+		return false;
 
-	uint8_t *buffer = new uint8_t[4096 * 4];
-	double rgba[4];
+	// Tables are indexed by slot, so removing or reordering rows needs no rebuild at all
+	std::vector<int> &changed = this->changedslots;
 
-	for (int i = 0; i < 4096; i++)
+	if (library != seenlibrary || !library->GetChangedSlots(seenversion, changed))
 	{
-		color->GetColor(i - 1024, rgba);
-		rgba[3] = opacity->GetValue(i - 1024);
+		changed.clear();
 
-		rgba[0] *= rgba[3];
-		rgba[1] *= rgba[3];
-		rgba[2] *= rgba[3];
+		for (int i = 0; i < library->GetSlotCount(); i++)
+			changed.push_back(i);
+	}
+
+	return true;
+}
+
+void VolumeMapper3D::UpdateTableRows(TransferTable *table, const TransferFunctionLibrary *&seenlibrary, unsigned int &seenversion)
+{
+	const TransferFunctionLibrary *library = this->library.get();
+
+	if (library == NULL || !CollectChangedSlots(seenlibrary, seenversion))
+		return;
+
+	table->SetRowCount(library->GetSlotCount());
+
+	const std::vector<int> &changed = this->changedslots;
+
+	for (size_t i = 0; i < changed.size(); i++)
+	{
+		const int slot = changed[i];
+
+		// Slots may have been removed again since the change
+		if (slot < library->GetSlotCount() && library->GetSlotRow(slot) != NULL)
+			table->UpdateRow(slot, library->GetSlotRow(slot), library->GetSlotGradient(slot));
+	}
+
+	seenlibrary = library;
+	seenversion = library->GetVersion();
+}
+
+void VolumeMapper3D::UpdateFanOutRows()
+{
+	const int outputs = GetFanOutCount();
+	const int base = (int)floorf(this->transferindex) % this->nrtransferrows;
+
+	if (this->fanoutrows == this->transferversion && this->fanoutbase == base && this->fanoutcount == outputs)
+		return;
+
+	// Each view shows the transfer function following the one of the view to its left
+	for (int i = 0; i < outputs; i++)
+		this->fanoutslots[i] = this->library->GetSlot((base + i) % this->nrtransferrows);
+
+	this->fanoutrows = this->transferversion;
+	this->fanoutbase = base;
+	this->fanoutcount = outputs;
+	this->fanoutversion++;
+}
+
+void VolumeMapper3D::UploadFanOutTexture(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	const bool create = storage->fanouttexture == 0;
+
+	if (!create && storage->fanoutversion == this->fanoutversion)
+		return;
+
+	if (create)
+		glGenTextures(1, &storage->fanouttexture);
+
+	storage->glstate->BindTexture(GL_TEXTURE_1D_ARRAY, storage->fanouttexture);
+
+	if (create)
+	{
+		glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+		// Nothing is blended, so the library rows are uploaded without conversion
+		glTexImage2D(GL_TEXTURE_1D_ARRAY, 0, GL_RGBA8, 4096, MAX_FAN_OUT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		CheckGLError();
+	}
+
+	for (int i = 0; i < this->fanoutcount; i++)
+	{
+		glTexSubImage2D(GL_TEXTURE_1D_ARRAY, 0, 0, i, 4096, 1, GL_RGBA, GL_UNSIGNED_BYTE, this->library->GetSlotRow(this->fanoutslots[i]));
+		CheckGLError();
+		CountUpload(renderer, TransferFunctionLibrary::ROW_BYTES);
+	}
+
+	storage->glstate->BindTexture(GL_TEXTURE_1D_ARRAY, 0);
+
+	storage->fanoutversion = this->fanoutversion;
+}
+
+int VolumeMapper3D::GetFanOutCount()
+{
+	if (this->displaymode != DisplayMode::DEMO || this->nrtransferrows < 2)
+		return 1;
+
+	// The classified volume holds a single transfer function
+	if (this->classificationmode == ClassificationMode::PRECLASSIFIED)
+		return 1;
+
+	return std::min(this->fanout, this->nrtransferrows);
+}
+
+void VolumeMapper3D::GetRenderSize(mitk::BaseRenderer *renderer, int size[2])
+{
+	// Side-by-side views split the window horizontally
+	size[0] = std::max(1, renderer->GetSizeX() / GetFanOutCount());
+	size[1] = renderer->GetSizeY();
+}
+
+void VolumeMapper3D::GetTransferLayers(float layers[2])
+{
+	layers[0] = layers[1] = 0.0f;
+
+	// The preview table has a single layer
+	if (this->displaymode != DisplayMode::DEMO || this->nrtransferrows < 1)
+		return;
+
+	const int bottom = (int)floorf(this->transferindex) % this->nrtransferrows;
+	const int top = (bottom + 1) % this->nrtransferrows;
+
+	layers[0] = (float)this->library->GetSlot(bottom);
+	layers[1] = (float)this->library->GetSlot(top);
+}
+
+void VolumeMapper3D::BlendTransferFunctions()
+{
+	if (this->blendedrows == this->transferversion && this->blendedindex == this->transferindex)
+		return;
+
+	// Same row selection and interpolation the ray caster used to perform for every sample:
+	// The row after the last one wraps around to the first.
+	const float weight = this->transferindex - floorf(this->transferindex);
+	const int bottom = (int)floorf(this->transferindex) % this->nrtransferrows;
+	const int top = (bottom + 1) % this->nrtransferrows;
+
+	const unsigned char *rowbottom = this->library->GetRow(bottom);
+	const unsigned char *rowtop = this->library->GetRow(top);
+
+	float *out = this->blendedtransfer.data();
+
+	for (int i = 0; i < 4096 * 4; i++)
+	{
+		const float a = (float)rowbottom[i] / 255.0f;
+		const float b = (float)rowtop[i] / 255.0f;
+		out[i] = a * (1.0f - weight) + b * weight;
+	}
+
+	this->blendedrows = this->transferversion;
+	this->blendedindex = this->transferindex;
+	this->blendedversion++;
+	this->blendedfirst = 0;
+	this->blendedcount = 4096;
+}
+
+void VolumeMapper3D::UploadTransferTexture(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	const bool create = storage->transfertexture == 0;
+
+	if (!create && storage->transferversion == this->blendedversion)
+		return;
+
+	if (create)
+		glGenTextures(1, &storage->transfertexture);
+
+	storage->glstate->BindTexture(GL_TEXTURE_1D, storage->transfertexture);
+
+	if (create)
+	{
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+		// Floating point storage, so the blended values reach the shader without being
+		// quantized a second time
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, 4096, 0, GL_RGBA, GL_FLOAT, NULL);
+		CheckGLError();
+	}
+
+	// A storage which is only one version behind needs the entries changed by the last one
+	int first = 0;
+	int count = 4096;
+
+	if (!create && storage->transferversion + 1 == this->blendedversion)
+	{
+		first = this->blendedfirst;
+		count = this->blendedcount;
+	}
+
+	glTexSubImage1D(GL_TEXTURE_1D, 0, first, count, GL_RGBA, GL_FLOAT, this->blendedtransfer.data() + first * 4);
+	CheckGLError();
+	CountUpload(renderer, count * 4 * sizeof(float));
+
+	storage->transferversion = this->blendedversion;
+}
+
+void VolumeMapper3D::UpdateTransferTexturePreview(mitk::BaseRenderer *renderer)
+{
+	// Looked up without creating a property object, which GetProperty(Pointer&, ...) would need
+	mitk::TransferFunctionProperty *property = dynamic_cast<mitk::TransferFunctionProperty*>(this->GetDataNode()->GetProperty("TransferFunction"));
+	if (property == NULL)
+		return;
+
+	vtkColorTransferFunction *color = property->GetValue()->GetColorTransferFunction();
+	vtkPiecewiseFunction *opacity = property->GetValue()->GetScalarOpacityFunction();
+	vtkPiecewiseFunction *gradient = property->GetValue()->GetGradientOpacityFunction();
+
+	// The MITK and VTK objects use separate clocks, so each one is compared on its own
+	PreviewStamp stamp;
+	stamp.function = property->GetValue()->GetMTime();
+	stamp.color = color->GetMTime();
+	stamp.opacity = opacity->GetMTime();
+	stamp.gradient = gradient->GetMTime();
+
+	const bool changed = !this->previewvalid || memcmp(&stamp, &this->previewstamp, sizeof(stamp)) != 0;
+
+	// Entries baked again, if any
+	int first = 0;
+	int count = 4096;
+	bool baked = false;
+
+	if (changed)
+	{
+		baked = BakePreviewRow(color, opacity, first, count);
+
+		// The gradient opacity is small enough to be baked completely
+		if (!this->previewvalid || stamp.gradient != this->previewstamp.gradient)
+		{
+			this->previewhasgradient = TransferFunctionBaker::BakeGradient(gradient, this->previewgradient.data());
+			this->previewgradientversion++;
+		}
+
+		this->previewstamp = stamp;
+		this->previewvalid = true;
+
+		if (baked)
+			this->previewversion++;
+	}
+
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	if (this->classificationmode == ClassificationMode::PREINTEGRATED)
+	{
+		PreIntegrationTable *table = this->preintegration[DisplayMode::PREVIEW];
+
+		if (this->previewtableversion != this->previewversion)
+		{
+			table->SetRowCount(1);
+			table->UpdateRow(0, this->previewrow.data(), NULL);
+			this->previewtableversion = this->previewversion;
+		}
+
+		UpdateTableTexture(renderer, table, storage->preintegrationtexture, storage->preintegrationlayers, storage->preintegrationversions);
+	}
+	else if (this->classificationmode == ClassificationMode::DENSITY_GRADIENT)
+	{
+		GradientTransferTable *table = this->gradienttables[DisplayMode::PREVIEW];
+
+		if (this->previewgradienttableversion != this->previewversion + this->previewgradientversion)
+		{
+			table->SetRowCount(1);
+			table->UpdateRow(0, this->previewrow.data(), this->previewhasgradient ? this->previewgradient.data() : NULL);
+			this->previewgradienttableversion = this->previewversion + this->previewgradientversion;
+		}
+
+		UpdateTableTexture(renderer, table, storage->gradienttexture, storage->gradientlayers, storage->gradientversions);
+	}
+
+	// A single row needs no blending. The demo rows must be blended again after preview mode ends.
+	if (baked || this->blendedrows != 0)
+	{
+		if (this->blendedrows != 0)
+		{
+			first = 0;
+			count = 4096;
+		}
+
+		for (int i = first * 4; i < (first + count) * 4; i++)
+			this->blendedtransfer[i] = (float)this->previewrow[i] / 255.0f;
+
+		this->blendedrows = 0;
+		this->blendedversion++;
+		this->blendedfirst = first;
+		this->blendedcount = count;
+	}
+
+	UploadTransferTexture(renderer);
+}
+
+bool VolumeMapper3D::BakePreviewRow(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, int &first, int &count)
+{
+	TransferFunctionNodes nodes;
+	TransferFunctionBaker::GetNodes(color, opacity, nodes);
+
+	first = 0;
+	count = 4096;
+
+	// Moving a node only affects the entries up to its neighbors
+	if (this->previewvalid && !TransferFunctionBaker::GetChangedRange(this->previewnodes, nodes, first, count))
+		return false;
+
+	TransferFunctionBaker::Bake(color, opacity, this->previewrow.data(), first, count);
+	this->previewnodes = nodes;
+
+	return true;
+}
+
+void VolumeMapper3D::CountUpload(mitk::BaseRenderer *renderer, size_t bytes)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	storage->uploads++;
+	storage->uploadbytes += bytes;
+}
+
+void VolumeMapper3D::UpdateTableTexture(mitk::BaseRenderer *renderer, TransferTable *table, unsigned int &texture, int &layers, std::vector<unsigned int> &versions)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	const int width = table->GetWidth();
+	const int height = table->GetHeight();
+	const int nrrows = table->GetRowCount();
+
+	if (nrrows < 1)
+		return;
+
+	if (texture == 0)
+		glGenTextures(1, &texture);
+
+	storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+	if (nrrows > layers)
+	{
+		layers = 4;
+		while (layers < nrrows)
+			layers *= 2;
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		CheckGLError();
+
+		versions.clear();
+	}
+
+	// Both display modes share the texture, each table brings its own versions
+	versions.resize(nrrows, 0);
+
+	// Upload only those layers whose table has been rebuilt since the last call
+	for (int i = 0; i < nrrows; i++)
+	{
+		if (versions[i] == table->GetVersion(i))
+			continue;
+
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, table->GetTable(i));
+		CheckGLError();
+		CountUpload(renderer, (size_t)width * height * 4);
+
+		versions[i] = table->GetVersion(i);
+	}
+
+	storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void VolumeMapper3D::UpdateClassifiedVolume()
+{
+	if (this->classificationmode != ClassificationMode::PRECLASSIFIED)
+	{
+		// The classified volume is as large as the volume itself, so it is only kept while
+		// it is in use
+		delete this->classifiedvolume;
+		this->classifiedvolume = NULL;
+		return;
+	}
+
+	bool rebake = false;
+
+	if (this->classifiedvolume == NULL)
+	{
+		this->classifiedvolume = new ClassifiedVolume();
+		this->classifiedtimestamp = 0;
+	}
+
+	vtkImageData *volume = dynamic_cast<mitk::Image*>(this->GetDataNode()->GetData())->GetVtkImageData();
+	const uint64_t mtime = volume->GetMTime();
+
+	if (this->classifiedtimestamp != mtime)
+	{
+		vtkImageData *normalized = CreateNormalizedVolume(volume);
+
+		int dim[3];
+		normalized->GetDimensions(dim);
+
+		this->classifiedvolume->SetVolume((const float*)normalized->GetScalarPointer(), dim);
+		normalized->Delete();
+
+		this->classifiedtimestamp = mtime;
+		rebake = true;
+	}
+
+	// The current transfer function as it is, transitions step from one to the next
+	const unsigned char *row = this->previewrow.data();
+	unsigned int version = this->previewversion;
+	int position = 0;
+
+	if (this->displaymode == DisplayMode::DEMO)
+	{
+		if (this->nrtransferrows < 1)
+			return;
+
+		position = (int)floorf(this->transferindex) % this->nrtransferrows;
+		row = this->library->GetRow(position);
+		version = this->transferversion;
+	}
+
+	if (!rebake && this->classifiedmode == this->displaymode && this->classifiedversion == version &&
+		this->classifiedposition == position && this->classifiedmodulation == this->modulation)
+		return;
+
+	// Cancels the bake in progress, if any
+	this->classifiedvolume->SetTransferFunction(row, this->modulation);
+
+	this->classifiedmode = this->displaymode;
+	this->classifiedversion = version;
+	this->classifiedposition = position;
+	this->classifiedmodulation = this->modulation;
+}
+
+void VolumeMapper3D::UpdateClassifiedTexture(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	ClassifiedVolume *volume = this->classifiedvolume;
+
+	if (volume == NULL)
+	{
+		if (storage->classifiedtexture != 0)
+		{
+			glDeleteTextures(1, &storage->classifiedtexture);
+			storage->classifiedtexture = 0;
+
+			// The name may be handed out again by a later glGenTextures in this frame
+			storage->glstate->Forget();
+			memset(storage->classifieddim, 0, sizeof(storage->classifieddim));
+			storage->classifiedversions.clear();
+		}
+
+		storage->classifiedmissing = 0;
+		storage->classifiedsettled = false;
+		return;
+	}
+
+	// Bakers publish bricks while holding the lock, so they wait until the upload is done
+	volume->Lock();
+
+	int dim[3];
+	volume->GetDimensions(dim);
+
+	const int count = volume->GetBrickCount();
+
+	if (storage->classifiedtexture == 0)
+		glGenTextures(1, &storage->classifiedtexture);
+
+	storage->glstate->BindTexture(GL_TEXTURE_3D, storage->classifiedtexture);
+
+	if (memcmp(dim, storage->classifieddim, sizeof(dim)) != 0)
+	{
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, dim[0], dim[1], dim[2], 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		CheckGLError();
+
+		memcpy(storage->classifieddim, dim, sizeof(dim));
+		storage->classifiedversions.assign(count, 0);
+	}
+
+	size_t uploaded = 0;
+	int outdated = 0;
+	storage->classifiedmissing = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		const unsigned int version = volume->GetBrickVersion(i);
+
+		// Bricks of a new volume keep the old voxels until they have been baked
+		if (version != 0 && version != storage->classifiedversions[i] && uploaded < MAX_CLASSIFIED_UPLOAD)
+		{
+			int origin[3], size[3];
+			volume->GetBrick(i, origin, size);
+
+			glTexSubImage3D(GL_TEXTURE_3D, 0, origin[0], origin[1], origin[2], size[0], size[1], size[2], GL_RGBA, GL_UNSIGNED_BYTE, volume->GetBrickVoxels(i));
+			CheckGLError();
+
+			const size_t bytes = (size_t)size[0] * size[1] * size[2] * 4;
+			CountUpload(renderer, bytes);
+			uploaded += bytes;
+
+			storage->classifiedversions[i] = version;
+			storage->classifieduploads++;
+		}
+
+		if (storage->classifiedversions[i] == 0)
+			storage->classifiedmissing++;
+
+		if (storage->classifiedversions[i] != version)
+			outdated++;
+	}
+
+	volume->Unlock();
+
+	storage->glstate->BindTexture(GL_TEXTURE_3D, 0);
+
+	storage->classifiedsettled = outdated == 0 && !volume->IsBaking();
+}
+
+void VolumeMapper3D::UpdateShadingTexture(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	if (this->shadingmode == ShadingMode::EXACT || (!this->lighting && !this->modulation))
+		return;
+
+	if (storage->shadingtable == NULL)
+		storage->shadingtable = new ShadingTable();
+
+	double direction[3];
+	renderer->GetVtkRenderer()->GetActiveCamera()->GetDirectionOfProjection(direction);
+
+	const float viewdir[3] = { (float)direction[0], (float)direction[1], (float)direction[2] };
+
+	const bool create = storage->shadingtexture == 0;
+
+	if (!storage->shadingtable->Update(viewdir) && !create)
+		return;
+
+	if (create)
+		glGenTextures(1, &storage->shadingtexture);
+
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->shadingtexture);
+
+	if (create)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, ShadingTable::SIZE, ShadingTable::SIZE, 0, GL_RG, GL_FLOAT, storage->shadingtable->GetTable());
+	}
+	else
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ShadingTable::SIZE, ShadingTable::SIZE, GL_RG, GL_FLOAT, storage->shadingtable->GetTable());
+	}
+
+	CheckGLError();
+	CountUpload(renderer, (size_t)ShadingTable::SIZE * ShadingTable::SIZE * 2 * sizeof(float));
+
+	storage->glstate->BindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VolumeMapper3D::SetDisplayMode(DisplayMode m)
+{
+	this->displaymode = m;
+}
+
+void VolumeMapper3D::SetClassificationMode(ClassificationMode m)
+{
+	this->classificationmode = m;
+}
+
+void VolumeMapper3D::SetLightingEnabled(bool enabled)
+{
+	this->lighting = enabled;
+}
+
+void VolumeMapper3D::SetOpacityModulationEnabled(bool enabled)
+{
+	this->modulation = enabled;
+}
+
+void VolumeMapper3D::SetGradientMethod(GradientMethod m)
+{
+	this->gradientmethod = m;
+}
+
+void VolumeMapper3D::SetEmptySpaceSkippingEnabled(bool enabled)
+{
+	this->emptyspaceskipping = enabled;
+}
+
+void VolumeMapper3D::SetShadingMode(ShadingMode m)
+{
+	this->shadingmode = m;
+}
+
+void VolumeMapper3D::SetFanOut(int count)
+{
+	this->fanout = std::min(std::max(count, 1), MAX_FAN_OUT);
+}
+
+int VolumeMapper3D::GetFanOut()
+{
+	return this->fanout;
+}
+
+void VolumeMapper3D::SetSampleCacheBudget(int megabytes)
+{
+	this->samplecachebudget = std::max(megabytes, 0);
+}
+
+int VolumeMapper3D::GetSampleCacheBudget()
+{
+	return this->samplecachebudget;
+}
+
+void VolumeMapper3D::SetProgressiveRefinementEnabled(bool enabled)
+{
+	if (this->progressive == enabled)
+		return;
+
+	this->progressive = enabled;
+	this->converged = false;
+}
+
+bool VolumeMapper3D::IsConverged()
+{
+	return this->converged;
+}
+
+void VolumeMapper3D::SetRenderScale(float scale)
+{
+	this->renderscale = std::min(std::max(scale, MIN_RENDER_SCALE), 1.0f);
+}
+
+float VolumeMapper3D::GetRenderScale()
+{
+	if (this->frametimebudget > 0.0f)
+		return this->resolutioncontroller->GetScale();
+
+	return this->renderscale;
+}
+
+void VolumeMapper3D::SetFrameTimeBudget(float ms)
+{
+	if (ms == this->frametimebudget)
+		return;
+
+	this->frametimebudget = ms;
+	this->resolutioncontroller->SetBudget(ms);
+	this->resolutioncontroller->Reset();
+}
+
+float VolumeMapper3D::GetFrameTimeBudget()
+{
+	return this->frametimebudget;
+}
+
+void VolumeMapper3D::SetTransferFunctionIndex(float index)
+{
+	this->transferindex = index;
+}
+
+float VolumeMapper3D::GetTransferFunctionIndex()
+{
+	return this->transferindex;
+}
+
+void VolumeMapper3D::Paint(mitk::BaseRenderer *renderer)
+{
+	if (!this->glinit)
+		return;
+
+	PROFILE_SCOPE("Paint");
+
+	const unsigned long long allocations = AllocationCounter::GetCount();
+
+	// Frames which build programs or pick up changed transfer functions may allocate
+	const int programs = this->builtprograms + this->cachedprograms;
+	const unsigned int transferversion = this->transferversion;
+	const unsigned int previewversion = this->previewversion;
+
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	QElapsedTimer painttimer;
+	painttimer.start();
+
+	// Anything may have been changed by other mappers since the last frame
+	storage->glstate->Begin();
+
+	if (storage->errormode != OpenGL::GetErrorMode())
+	{
+		OpenGL::ApplyErrorMode();
+		storage->errormode = OpenGL::GetErrorMode();
+	}
+
+	if (this->firstframe)
+	{
+		int issued, skipped, queries;
+		storage->glstate->GetFrameCounts(issued, skipped, queries);
+
+		this->glcalls.issued += issued;
+		this->glcalls.skipped += skipped;
+		this->glcalls.queries += queries;
+		this->glcalls.uploads += storage->uploads;
+		this->glcalls.uploadbytes += storage->uploadbytes;
+		this->glcalls.frames++;
+	}
+
+	storage->uploads = 0;
+	storage->uploadbytes = 0;
+
+	SaveWindow(renderer);
+	SaveFramebufferState(renderer);
+
+	if (storage->vertexarray == 0)
+		glGenVertexArrays(1, &storage->vertexarray);
+
+	storage->glstate->BindVertexArray(storage->vertexarray);
+
+	// Collect timings of previous frames
+	CollectGpuTimes(renderer);
+
+	LogPassTimings();
+
+	// Create or update all texture objects
+	{
+		PROFILE_SCOPE("Update textures");
+		storage->uploadtimer->Begin();
+		UpdateVolumeTexture(renderer);
+		UpdateTransferTexture(renderer);
+		UpdateClassifiedVolume();
+		UpdateClassifiedTexture(renderer);
+		UpdateShadingTexture(renderer);
+		storage->uploadtimer->End();
+	}
+
+	// Create or update all shaders
+	{
+		PROFILE_SCOPE("Update shaders");
+		UpdateShaderProgram(renderer, storage->raysetupprogram, "vertex-setup.glsl", "fragment-setup.glsl");
+		UpdateRaycastProgram(renderer);
+
+		if (this->progressive || GetFanOutCount() > 1)
+			UpdateShaderProgram(renderer, storage->compositeprogram, "vertex-raycast.glsl", "fragment-composite.glsl");
+
+		if (this->renderscale < 1.0f || this->frametimebudget > 0.0f)
+			UpdateShaderProgram(renderer, storage->upsampleprogram, "vertex-raycast.glsl", "fragment-upsample.glsl");
+	}
+
+	// Create or update all vertex buffers
+	{
+		PROFILE_SCOPE("Update vertex buffers");
+		UpdateBoundsVertexBuffer(renderer);
+		UpdateQuadVertexBuffer(renderer);
+	}
+
+	// Create or update all FBOs
+	{
+		PROFILE_SCOPE("Update framebuffers");
+		UpdateFramebufferObjects(renderer);
+	}
+
+	// Anything visible changed since the last frame?
+	FrameState state;
+	GetFrameState(renderer, state);
+
+	const bool changed = memcmp(&state, &storage->framestate, sizeof(state)) != 0;
+
+	// Only a moving camera or volume counts as motion. Other changes, like a transfer function
+	// transition, are rendered at full quality and don't drive the resolution controller.
+	const bool moving = memcmp(state.view, storage->framestate.view, sizeof(state.view)) != 0 ||
+		memcmp(state.projection, storage->framestate.projection, sizeof(state.projection)) != 0 ||
+		memcmp(state.model, storage->framestate.model, sizeof(state.model)) != 0;
+
+	// A new shader variant, window size or volume may create resources as well
+	const bool setupchanged = state.features != storage->framestate.features ||
+		memcmp(state.size, storage->framestate.size, sizeof(state.size)) != 0 ||
+		memcmp(state.targetsize, storage->framestate.targetsize, sizeof(state.targetsize)) != 0 ||
+		state.volumetimestamp != storage->framestate.volumetimestamp;
+
+	if (changed)
+	{
+		storage->framestate = state;
+		storage->accumulatedframes = 0;
+		storage->shadingcompared = false;
+	}
+
+	UpdateFrameData(renderer, state);
+
+	const bool fanout = GetFanOutCount() > 1 && storage->compositeprogram != NULL;
+
+	// With a camera at rest, frames rendered from the sample cache are cheap enough for full
+	// quality even while the transfer function changes
+	const bool cached = !fanout && UpdateSampleCache(renderer, state);
+
+	// While in motion, the volume may be rendered at reduced resolution and with a longer
+	// step, the next unchanged frame brings back full quality.
+	const float scale = moving && !fanout && !cached ? GetRenderScale() : 1.0f;
+	float stepfactor = 1.0f;
+
+	if (moving && this->frametimebudget > 0.0f && !cached)
+		stepfactor = this->resolutioncontroller->GetStepFactor();
+
+	unsigned int tag = moving && !cached ? TAG_MOTION : 0;
+
+	if (scale < 1.0f || stepfactor > 1.0f)
+		tag |= TAG_REDUCED;
+
+	// Actual draw calls
+	{
+		PROFILE_SCOPE("Draw");
+
+		if (fanout)
+		{
+			RenderFanOut(renderer, stepfactor, tag);
+			this->converged = stepfactor == 1.0f;
+		}
+		else if (cached)
+		{
+			RenderCached(renderer, tag);
+			this->converged = true;
+		}
+		else if (scale < 1.0f && storage->upsampleprogram != NULL)
+		{
+			RenderReduced(renderer, scale, stepfactor, tag);
+			this->converged = false;
+		}
+		else if (this->progressive)
+		{
+			RenderProgressive(renderer, tag);
+		}
+		else
+		{
+			RenderBoundingBox(renderer);
+			glClear(GL_COLOR_BUFFER_BIT);
+			RenderVolume(renderer, stepfactor, tag);
+			this->converged = stepfactor == 1.0f;
+		}
+
+		// Keep frames coming until the classified volume is complete
+		if (this->classifiedvolume != NULL && !storage->classifiedsettled)
+			this->converged = false;
+
+		// Once per view, independent of how the frame itself has been rendered
+		if (this->shadingmode == ShadingMode::COMPARE && !storage->shadingcompared)
+		{
+			CompareShading(renderer);
+			storage->shadingcompared = true;
+		}
+	}
+
+	// Restore everything
+	storage->glstate->BindVertexArray(0);
+	storage->glstate->UseProgram(0);
+	RestoreFramebufferState(renderer);
+
+	// CPU time spent in Paint, which includes any stalls caused by error checking
+	if (this->firstframe)
+		this->glcalls.painttime += (double)painttimer.nsecsElapsed() / 1.0e6;
+
+	const bool steady = !setupchanged && programs == this->builtprograms + this->cachedprograms &&
+		transferversion == this->transferversion && previewversion == this->previewversion;
+
+	// Once all resources exist, an unchanged setup must render without heap allocations. Only
+	// allocations of the render thread are counted. Any other allocation fails the run, so it
+	// can't go unnoticed.
+	if (this->firstframe && this->glcalls.frames > ALLOCATION_WARMUP_FRAMES && steady && AllocationCounter::IsEnabled())
+	{
+		const long long count = (long long)(AllocationCounter::GetCount() - allocations);
+
+		this->glcalls.allocations += count;
+		this->glcalls.allocationframes++;
+
+		if (count > 0)
+		{
+			fprintf(stderr, "Error: %lld heap allocations in frame %d\n", count, this->glcalls.frames);
+			abort();
+		}
+	}
+
+	if (!this->firstframe && storage->raycastprogram != NULL)
+	{
+		// Wait for the GPU once, so the reported time includes the actual rendering
+		glFinish();
+
+		printf("Time to first frame: %.1f ms (%d shader programs built in %.1f ms, %d from the binary cache)\n",
+			(double)this->startuptimer.nsecsElapsed() / 1.0e6, this->builtprograms, this->programbuildtime, this->cachedprograms);
+
+		this->firstframe = true;
+	}
+}
+
+void VolumeMapper3D::GetFrameState(mitk::BaseRenderer *renderer, FrameState &state)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
-		buffer[i * 4 + 0] = (uint8_t)(rgba[0] * 255.0);
-		buffer[i * 4 + 1] = (uint8_t)(rgba[1] * 255.0);
-		buffer[i * 4 + 2] = (uint8_t)(rgba[2] * 255.0);
-		buffer[i * 4 + 3] = (uint8_t)(rgba[3] * 255.0);
+	// Clear padding bytes as well, states are compared with memcmp
+	memset(&state, 0, sizeof(state));
+
+	GetViewMatrix(renderer, state.view);
+	GetProjectionMatrix(renderer, state.projection);
+	GetInverseModelMatrix(renderer, state.model);
+
+	state.transferindex = this->transferindex;
+	state.transferversion = this->blendedversion;
+	state.gradientversion = this->previewgradientversion;
+	state.fanoutversion = this->fanoutversion;
+	state.classifieduploads = storage->classifieduploads;
+	state.features = storage->raycastfeatures;
+	state.volumetimestamp = storage->volumetimestamp;
+	state.size[0] = renderer->GetSizeX();
+	state.size[1] = renderer->GetSizeY();
+
+	// Reallocated targets have lost their contents
+	state.targetsize[0] = storage->targets->GetWidth();
+	state.targetsize[1] = storage->targets->GetHeight();
+}
+
+void VolumeMapper3D::UpdateFrameData(mitk::BaseRenderer *renderer, const FrameState &state)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	FrameData data;
+	memcpy(data.view, state.view, sizeof(data.view));
+	memcpy(data.projection, state.projection, sizeof(data.projection));
+	memcpy(data.invertedmodel, state.model, sizeof(data.invertedmodel));
+	GetCameraPosition(renderer, data.camerapos);
+	data.camerapos[3] = 1.0f;
+	data.transferindex = this->transferindex;
+	data.padding = 0.0f;
+	storage->targets->GetWindowScale(data.targetscale);
+
+	if (storage->framedatabuffer == 0)
+	{
+		glGenBuffers(1, &storage->framedatabuffer);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, storage->framedatabuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+		CheckGLError();
 	}
-	
+	else
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, storage->framedatabuffer);
+	}
+
+	// One write for all per-frame values of all programs
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+	CountUpload(renderer, sizeof(FrameData));
+}
+
+void VolumeMapper3D::RenderProgressive(mitk::BaseRenderer *renderer, unsigned int tag)
+{
 	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
-	
-	if (!glIsTexture(storage->transfertexture))
-		glGenTextures(1, &storage->transfertexture);
 
-	glBindTexture(GL_TEXTURE_2D, storage->transfertexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	if (storage->compositeprogram == NULL)
+		return;
+
+	// Paint starts over whenever anything visible has changed
+	this->converged = storage->accumulatedframes >= PROGRESSIVE_FRAMES;
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 4096, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
-	CheckGLError();
+	if (storage->accumulatedframes < PROGRESSIVE_FRAMES)
+	{
+		RenderBoundingBox(renderer);
+
+		SaveFramebufferState(renderer);
+		storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->targets->GetFramebuffer(TARGET_ACCUMULATION));
+
+		// Running average: The n-th frame is weighted with 1 / n, so the first one
+		// simply replaces the previous contents.
+		const bool blend = storage->glstate->IsBlendEnabled();
+		storage->glstate->SetBlendEnabled(true);
+		glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+		glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / (float)(storage->accumulatedframes + 1));
+
+		RenderVolume(renderer, 1.0f, tag);
 
-	delete[] buffer;
+		storage->glstate->SetBlendEnabled(blend);
+
+		RestoreFramebufferState(renderer);
+
+		storage->accumulatedframes++;
+
+		if (storage->accumulatedframes == PROGRESSIVE_FRAMES)
+			this->converged = true;
+	}
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	RenderComposite(renderer, storage->targets->GetTexture(TARGET_ACCUMULATION));
 }
 
-void VolumeMapper3D::SetDisplayMode(DisplayMode m)
+void VolumeMapper3D::RenderReduced(mitk::BaseRenderer *renderer, float scale, float stepfactor, unsigned int tag)
 {
-	this->displaymode = m;
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	RenderBoundingBox(renderer);
+
+	const int w = std::max(1, (int)(renderer->GetSizeX() * scale));
+	const int h = std::max(1, (int)(renderer->GetSizeY() * scale));
+
+	SaveFramebufferState(renderer);
+	storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->targets->GetFramebuffer(TARGET_REDUCED));
+	glViewport(0, 0, w, h);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	RenderVolume(renderer, stepfactor, tag);
+
+	// Like all offscreen targets, the window is covered by the renderer completely
+	RestoreFramebufferState(renderer);
+	glViewport(0, 0, renderer->GetSizeX(), renderer->GetSizeY());
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	storage->glstate->UseProgram(storage->upsampleprogram->GetProgram());
+
+	storage->glstate->ActiveTexture(0);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_REDUCED));
+
+	storage->glstate->ActiveTexture(1);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_FRONTFACES));
+
+	storage->glstate->ActiveTexture(2);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_BACKFACES));
+
+	const int location = storage->upsampleprogram->GetUniformLocation("uvscale");
+	glUniform2f(location, (float)w / (float)renderer->GetSizeX(), (float)h / (float)renderer->GetSizeY());
+
+	BindQuadVertexBuffer(renderer);
+
+	storage->compositetimer->Begin();
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	storage->compositetimer->End();
+	CheckGLError();
 }
 
-void VolumeMapper3D::SetTransferFunctionIndex(float index)
+void VolumeMapper3D::RenderFanOut(mitk::BaseRenderer *renderer, float stepfactor, unsigned int tag)
 {
-	this->transferindex = index;
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	const int outputs = GetFanOutCount();
+
+	int size[2];
+	GetRenderSize(renderer, size);
+
+	// All views share the camera, so ray setup and ray casting happen once at the size of a
+	// single view
+	glViewport(0, 0, size[0], size[1]);
+
+	RenderBoundingBox(renderer);
+
+	SaveFramebufferState(renderer);
+	storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->fanoutframebuffer);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	RenderVolume(renderer, stepfactor, tag);
+
+	RestoreFramebufferState(renderer);
+	glViewport(0, 0, renderer->GetSizeX(), renderer->GetSizeY());
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// One composite pass per view, measured together
+	storage->glstate->UseProgram(storage->compositeprogram->GetProgram());
+	storage->glstate->ActiveTexture(0);
+	BindQuadVertexBuffer(renderer);
+
+	storage->compositetimer->Begin();
+
+	for (int i = 0; i < outputs; i++)
+	{
+		glViewport(i * size[0], 0, size[0], size[1]);
+		storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_FAN_OUT + i));
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+
+	storage->compositetimer->End();
+	CheckGLError();
+
+	glViewport(0, 0, renderer->GetSizeX(), renderer->GetSizeY());
 }
 
-float VolumeMapper3D::GetTransferFunctionIndex()
+bool VolumeMapper3D::UpdateSampleCache(mitk::BaseRenderer *renderer, const FrameState &state)
 {
-	return this->transferindex;
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	// Everything the samples depend on. Transfer functions and classification don't matter,
+	// except for the longer step of pre-integrated classification.
+	FrameState key;
+	memcpy(&key, &state, sizeof(key));
+	key.transferindex = 0.0f;
+	key.transferversion = 0;
+	key.gradientversion = 0;
+	key.fanoutversion = 0;
+	key.features &= FEATURE_FORWARD_GRADIENT | FEATURE_PREINTEGRATED;
+
+	const bool moved = memcmp(&key, &storage->lastcachekey, sizeof(key)) != 0;
+	memcpy(&storage->lastcachekey, &key, sizeof(key));
+
+	// Classified volumes need a single fetch per sample anyway
+	if (this->samplecachebudget <= 0 || this->progressive || this->classificationmode == ClassificationMode::PRECLASSIFIED)
+	{
+		// Give the memory of a disabled cache back
+		if (storage->samplecache != 0)
+		{
+			glDeleteTextures(1, &storage->samplecache);
+			storage->samplecache = 0;
+			storage->glstate->Forget();
+			memset(storage->samplecachesize, 0, sizeof(storage->samplecachesize));
+		}
+
+		storage->samplecachevalid = false;
+		return false;
+	}
+
+	// Capturing only pays off if the camera stays where it is, which is assumed once it has
+	// been at rest for a frame
+	if (moved)
+	{
+		storage->samplecachevalid = false;
+		return false;
+	}
+
+	if (storage->samplecachevalid && memcmp(&key, &storage->samplecachekey, sizeof(key)) == 0)
+		return true;
+
+	const int w = renderer->GetSizeX();
+	const int h = renderer->GetSizeY();
+
+	// 8 bytes per pixel and sample, in whole capture passes
+	const long long budget = (long long)this->samplecachebudget * 1024 * 1024;
+	int layers = (int)std::min<long long>(MAX_CACHED_SAMPLES, budget / ((long long)w * h * 8));
+	layers -= layers % CAPTURE_LAYERS;
+
+	if (layers < CAPTURE_LAYERS)
+		return false;
+
+	if (storage->samplecachesize[0] != w || storage->samplecachesize[1] != h || storage->samplecachesize[2] != layers)
+	{
+		if (storage->samplecache == 0)
+			glGenTextures(1, &storage->samplecache);
+
+		storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, storage->samplecache);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16, w, h, layers, 0, GL_RGBA, GL_UNSIGNED_SHORT, NULL);
+		CheckGLError();
+
+		storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		storage->samplecachesize[0] = w;
+		storage->samplecachesize[1] = h;
+		storage->samplecachesize[2] = layers;
+	}
+
+	// Captured by RenderCached, once the ray setup pass of this frame is done
+	memcpy(&storage->samplecachekey, &key, sizeof(key));
+	storage->samplecachevalid = false;
+
+	return true;
 }
 
-void VolumeMapper3D::Paint(mitk::BaseRenderer *renderer)
+void VolumeMapper3D::CaptureSamples(mitk::BaseRenderer *renderer)
 {
-	if (!this->glinit)
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	// Same gradients and step as the frames reading the samples
+	const unsigned int features = storage->raycastfeatures;
+	ShaderProgram *program = GetRaycastProgram(renderer, FEATURE_CAPTURE_SAMPLES | (features & FEATURE_FORWARD_GRADIENT));
+
+	if (program == NULL)
 		return;
 
-	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+	storage->glstate->UseProgram(program->GetProgram());
+
+	storage->glstate->ActiveTexture(0);
+	storage->glstate->BindTexture(GL_TEXTURE_3D, storage->volumetexture);
+
+	storage->glstate->ActiveTexture(1);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_FRONTFACES));
+
+	storage->glstate->ActiveTexture(2);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_BACKFACES));
+
+	int location = program->GetUniformLocation("stepfactor");
+	glUniform1f(location, (features & FEATURE_PREINTEGRATED) ? PREINTEGRATION_STEP_FACTOR : 1.0f);
+
+	BindQuadVertexBuffer(renderer);
 
-	SaveWindow(renderer);
 	SaveFramebufferState(renderer);
 
-	if (storage->vertexarray == 0)
-		glGenVertexArrays(1, &storage->vertexarray);
+	if (storage->samplecacheframebuffer == 0)
+	{
+		glGenFramebuffers(1, &storage->samplecacheframebuffer);
+		storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->samplecacheframebuffer);
 
-	glBindVertexArray(storage->vertexarray);
+		GLenum buffers[CAPTURE_LAYERS];
 
-	// Create or update all texture objects
-	UpdateVolumeTexture(renderer);
-	UpdateTransferTexture(renderer);
+		for (int i = 0; i < CAPTURE_LAYERS; i++)
+			buffers[i] = GL_COLOR_ATTACHMENT0 + i;
 
-	// Create or update all shaders
-	UpdateShaderProgram(renderer, storage->raysetupprogram, "vertex-setup.glsl", "fragment-setup.glsl");
-	UpdateShaderProgram(renderer, storage->raycastprogram, "vertex-raycast.glsl", "fragment-raycast.glsl");
+		glDrawBuffers(CAPTURE_LAYERS, buffers);
+	}
+	else
+	{
+		storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->samplecacheframebuffer);
+	}
 
-	// Create or update all vertex buffers
-	UpdateBoundsVertexBuffer(renderer);
-	UpdateQuadVertexBuffer(renderer);
+	// Samples are data, not colors
+	const bool blend = storage->glstate->IsBlendEnabled();
+	storage->glstate->SetBlendEnabled(false);
 
-	// Create or update all FBOs
-	UpdateFramebufferObjects(renderer);
+	location = program->GetUniformLocation("firstsample");
 
-	// Actual draw calls
-	RenderBoundingBox(renderer);
-	RenderVolume(renderer);
+	// Each pass writes the next CAPTURE_LAYERS samples of all rays
+	for (int first = 0; first < storage->samplecachesize[2]; first += CAPTURE_LAYERS)
+	{
+		for (int i = 0; i < CAPTURE_LAYERS; i++)
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, storage->samplecache, 0, first + i);
+
+		glUniform1i(location, first);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+
+	CheckGLError();
+
+	storage->glstate->SetBlendEnabled(blend);
 
-	// Restore everything
-	glBindVertexArray(0);
-	glUseProgram(0);
 	RestoreFramebufferState(renderer);
+
+	storage->samplecachevalid = true;
 }
 
-void VolumeMapper3D::RenderBoundingBox(mitk::BaseRenderer *renderer)
+void VolumeMapper3D::RenderCached(mitk::BaseRenderer *renderer, unsigned int tag)
 {
 	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
-	if (storage->raysetupprogram == NULL)
+	RenderBoundingBox(renderer);
+
+	if (!storage->samplecachevalid)
+		CaptureSamples(renderer);
+
+	// The variant reading the cache differs from the regular one only in where the first
+	// samples come from
+	ShaderProgram *program = NULL;
+
+	if (storage->samplecachevalid)
+		program = GetRaycastProgram(renderer, storage->raycastfeatures | FEATURE_CACHED_SAMPLES);
+
+	if (program != NULL)
+	{
+		storage->raycastprogram = program;
+		storage->raycastfeatures |= FEATURE_CACHED_SAMPLES;
+	}
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	RenderVolume(renderer, 1.0f, tag);
+}
+
+void VolumeMapper3D::CompareShading(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	// Both frames at full quality, without jittered ray starts or cached samples
+	const unsigned int features = storage->raycastfeatures & ~(FEATURE_JITTER | FEATURE_CACHED_SAMPLES);
+
+	if ((features & FEATURE_SHADING_TABLE) == 0 || (features & FAN_OUT_FEATURES) != 0)
 		return;
 
+	const unsigned int variants[2] = { features, features & ~FEATURE_SHADING_TABLE };
+	ShaderProgram *programs[2];
+
+	for (int i = 0; i < 2; i++)
+	{
+		programs[i] = GetRaycastProgram(renderer, variants[i]);
+
+		if (programs[i] == NULL)
+			return;
+	}
+
+	PROFILE_SCOPE("CompareShading");
+
+	const int w = renderer->GetSizeX();
+	const int h = renderer->GetSizeY();
+	const size_t bytes = (size_t)w * h * 4;
+
+	ShaderProgram *program = storage->raycastprogram;
+	const unsigned int current = storage->raycastfeatures;
+
+	RenderBoundingBox(renderer);
+
 	SaveFramebufferState(renderer);
+	storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->targets->GetFramebuffer(TARGET_COMPARE));
+	glViewport(0, 0, w, h);
 
-	storage->raysetupprogram->Enable();
+	// The raw output of the ray caster, like the window shows it without blending
+	const bool blend = storage->glstate->IsBlendEnabled();
+	storage->glstate->SetBlendEnabled(false);
 
-	int location = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		storage->raycastprogram = programs[i];
+		storage->raycastfeatures = variants[i];
 
-	float view[16];
-	GetViewMatrix(renderer, view);
-	location = storage->raysetupprogram->GetUniformLocation("view");
-	glUniformMatrix4fv(location, 1, GL_FALSE, view);
+		glClear(GL_COLOR_BUFFER_BIT);
 
-	float projection[16];
-	GetProjectionMatrix(renderer, projection);
-	location = storage->raysetupprogram->GetUniformLocation("projection");
-	glUniformMatrix4fv(location, 1, GL_FALSE, projection);
+		// Tagged as reduced, so these passes stay out of the shader variant times
+		RenderVolume(renderer, 1.0f, TAG_REDUCED);
+
+		this->shadingimages[i].resize(bytes);
+		glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, this->shadingimages[i].data());
+		CheckGLError();
+	}
+
+	storage->raycastprogram = program;
+	storage->raycastfeatures = current;
+
+	storage->glstate->SetBlendEnabled(blend);
+	RestoreFramebufferState(renderer);
+	glViewport(0, 0, renderer->GetSizeX(), renderer->GetSizeY());
+
+	const unsigned char *table = this->shadingimages[0].data();
+	const unsigned char *exact = this->shadingimages[1].data();
+	ShadingDifference &difference = this->shadingdifference;
+
+	for (size_t i = 0; i < bytes; i++)
+	{
+		const int d = abs((int)table[i] - (int)exact[i]);
+
+		difference.sum += d;
+		difference.sumsquares += d * d;
+		difference.max = std::max(difference.max, d);
+
+		if (d > 2)
+			difference.above++;
+	}
+
+	difference.values += bytes;
+	difference.frames++;
+}
+
+void VolumeMapper3D::BindQuadVertexBuffer(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	storage->glstate->BindBuffer(GL_ARRAY_BUFFER, storage->quadvertexbuffer);
+
+	glEnableVertexAttribArray(ATTRIBUTE_VERTEX);
+	glVertexAttribPointer(ATTRIBUTE_VERTEX, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), NULL);
+
+	glEnableVertexAttribArray(ATTRIBUTE_UV);
+	glVertexAttribPointer(ATTRIBUTE_UV, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+}
+
+void VolumeMapper3D::RenderComposite(mitk::BaseRenderer *renderer, unsigned int texture)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	storage->glstate->UseProgram(storage->compositeprogram->GetProgram());
+
+	storage->glstate->ActiveTexture(0);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, texture);
+
+	BindQuadVertexBuffer(renderer);
+
+	storage->compositetimer->Begin();
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	storage->compositetimer->End();
+	CheckGLError();
+}
+
+void VolumeMapper3D::RenderBoundingBox(mitk::BaseRenderer *renderer)
+{
+	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
+
+	if (storage->raysetupprogram == NULL)
+		return;
+
+	SaveFramebufferState(renderer);
 
-	glBindBuffer(GL_ARRAY_BUFFER, storage->boundsvertexbuffer);
-	location = storage->raysetupprogram->GetAttributeLocation("vertex");
-	glEnableVertexAttribArray(location);
-	glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+	storage->glstate->UseProgram(storage->raysetupprogram->GetProgram());
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, storage->boundsindexbuffer);
+	// View and projection matrix are part of the frame data
+	storage->glstate->BindBuffer(GL_ARRAY_BUFFER, storage->boundsvertexbuffer);
+	glEnableVertexAttribArray(ATTRIBUTE_VERTEX);
+	glVertexAttribPointer(ATTRIBUTE_VERTEX, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+	storage->glstate->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, storage->boundsindexbuffer);
 
 	glEnable(GL_CULL_FACE);
 
+	storage->setuptimer->Begin();
+
 	// Draw front faces only
-	glBindFramebuffer(GL_FRAMEBUFFER, storage->frontbackfacefbos[0]);
+	storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->targets->GetFramebuffer(TARGET_FRONTFACES));
 	glClear(GL_COLOR_BUFFER_BIT);
 	glCullFace(GL_BACK);
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, NULL);
 
 	// Draw back faces only
-	glBindFramebuffer(GL_FRAMEBUFFER, storage->frontbackfacefbos[1]);
+	storage->glstate->BindFramebuffer(GL_FRAMEBUFFER, storage->targets->GetFramebuffer(TARGET_BACKFACES));
 	glClear(GL_COLOR_BUFFER_BIT);
 	glCullFace(GL_FRONT);
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, NULL);
 
+	storage->setuptimer->End();
+
 	glDisable(GL_CULL_FACE);
 
 	RestoreFramebufferState(renderer);
 }
 
-void VolumeMapper3D::RenderVolume(mitk::BaseRenderer *renderer)
+void VolumeMapper3D::RenderVolume(mitk::BaseRenderer *renderer, float stepfactor, unsigned int tag)
 {
 	LocalStorage *storage = this->storagehandler.GetLocalStorage(renderer);
 
 	if (storage->raycastprogram == NULL)
 		return;
 
-	glClear(GL_COLOR_BUFFER_BIT);
+	storage->glstate->UseProgram(storage->raycastprogram->GetProgram());
+
+	// Sampler units are assigned once by InitializeProgram. Camera, matrices and transfer
+	// function index are part of the frame data.
+	storage->glstate->ActiveTexture(0);
+	storage->glstate->BindTexture(GL_TEXTURE_3D, storage->volumetexture);
+
+	storage->glstate->ActiveTexture(1);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_FRONTFACES));
+
+	storage->glstate->ActiveTexture(2);
+	storage->glstate->BindTexture(GL_TEXTURE_2D, storage->targets->GetTexture(TARGET_BACKFACES));
+
+	const unsigned int features = storage->raycastfeatures;
 
-	storage->raycastprogram->Enable();
+	if (features & FEATURE_PRECLASSIFIED)
+	{
+		storage->glstate->ActiveTexture(3);
+		storage->glstate->BindTexture(GL_TEXTURE_3D, storage->classifiedtexture);
+	}
+	else if (features & FEATURE_PREINTEGRATED)
+	{
+		storage->glstate->ActiveTexture(4);
+		storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, storage->preintegrationtexture);
+	}
+	else if (features & FEATURE_CLASSIFY_2D)
+	{
+		storage->glstate->ActiveTexture(5);
+		storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, storage->gradienttexture);
+	}
+	else if (features & FAN_OUT_FEATURES)
+	{
+		storage->glstate->ActiveTexture(6);
+		storage->glstate->BindTexture(GL_TEXTURE_1D_ARRAY, storage->fanouttexture);
+	}
+	else
+	{
+		storage->glstate->ActiveTexture(3);
+		storage->glstate->BindTexture(GL_TEXTURE_1D, storage->transfertexture);
+	}
 
 	int location = 0;
 
-	location = storage->raycastprogram->GetUniformLocation("volume");
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, storage->volumetexture);
-	glUniform1i(location, 0);
+	if (features & FEATURE_PREINTEGRATED)
+		stepfactor *= PREINTEGRATION_STEP_FACTOR;
+
+	if (features & FEATURE_JITTER)
+	{
+		stepfactor *= PROGRESSIVE_STEP_FACTOR;
+
+		// Golden ratio sequence: Successive frames cover the step evenly
+		const float jitter = (float)storage->accumulatedframes * 0.618034f;
+		location = storage->raycastprogram->GetUniformLocation("jitter");
+		glUniform1f(location, jitter - floorf(jitter));
+	}
+
+	location = storage->raycastprogram->GetUniformLocation("stepfactor");
+	glUniform1f(location, stepfactor);
 
-	location = storage->raycastprogram->GetUniformLocation("frontfaces");
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, storage->frontbackfacetextures[0]);
-	glUniform1i(location, 1);
+	if (features & (FEATURE_PREINTEGRATED | FEATURE_CLASSIFY_2D))
+	{
+		// Layers of the two active transfer functions, by library slot
+		float layers[2];
+		GetTransferLayers(layers);
 
-	location = storage->raycastprogram->GetUniformLocation("backfaces");
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, storage->frontbackfacetextures[1]);
-	glUniform1i(location, 2);
+		location = storage->raycastprogram->GetUniformLocation("layers");
+		glUniform2f(location, layers[0], layers[1]);
+	}
 
-	location = storage->raycastprogram->GetUniformLocation("transfer");
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, storage->transfertexture);
-	glUniform1i(location, 3);
+	if (features & FAN_OUT_FEATURES)
+	{
+		// Tables are indexed by library slot, the fan-out texture by view
+		const bool tables = (features & (FEATURE_PREINTEGRATED | FEATURE_CLASSIFY_2D)) != 0;
+		float fanlayers[MAX_FAN_OUT];
 
-	location = storage->raycastprogram->GetUniformLocation("transferindex");
-	glUniform1f(location, this->transferindex);
+		for (int i = 0; i < MAX_FAN_OUT; i++)
+			fanlayers[i] = tables ? (float)this->fanoutslots[i] : (float)i;
 
-	float camerapos[3];
-	GetCameraPosition(renderer, camerapos);
-	location = storage->raycastprogram->GetUniformLocation("camerapos");
-	glUniform3fv(location, 1, camerapos);
+		location = storage->raycastprogram->GetUniformLocation("fanlayers");
+		glUniform4fv(location, 1, fanlayers);
+	}
 
-	float model[16];
-	GetInverseModelMatrix(renderer, model);
-	location = storage->raycastprogram->GetUniformLocation("invertedmodel");
-	glUniformMatrix4fv(location, 1, GL_FALSE, model);
+	if (features & FEATURE_CLASSIFY_2D)
+	{
+		// Gradients are differences over two voxels of the normalized volume, the table height
+		// spans GRADIENT_RANGE scalar units per voxel
+		const float scale = (TransferFunctionBaker::SIZE / 2.0f) / TransferFunctionBaker::GRADIENT_RANGE;
 
-	glBindBuffer(GL_ARRAY_BUFFER, storage->quadvertexbuffer);
-	CheckGLError();
-	location = storage->raycastprogram->GetAttributeLocation("vertex");
-	glEnableVertexAttribArray(location);
-	glVertexAttribPointer(location, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), NULL);
-	CheckGLError();
+		location = storage->raycastprogram->GetUniformLocation("gradientscale");
+		glUniform1f(location, scale);
+	}
 
-	location = storage->raycastprogram->GetAttributeLocation("uv");
-	glEnableVertexAttribArray(location);
-	glVertexAttribPointer(location, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+	if (features & FEATURE_SHADING_TABLE)
+	{
+		storage->glstate->ActiveTexture(8);
+		storage->glstate->BindTexture(GL_TEXTURE_2D, storage->shadingtexture);
+	}
+
+	if (features & FEATURE_CACHED_SAMPLES)
+	{
+		storage->glstate->ActiveTexture(7);
+		storage->glstate->BindTexture(GL_TEXTURE_2D_ARRAY, storage->samplecache);
+
+		location = storage->raycastprogram->GetUniformLocation("cachedsamples");
+		glUniform1i(location, storage->samplecachesize[2]);
+	}
+
+	BindQuadVertexBuffer(renderer);
 	CheckGLError();
 
+	storage->raycasttimer->Begin(features | tag);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	storage->raycasttimer->End();
 	CheckGLError();
-
-	storage->raycastprogram->Disable();
 }
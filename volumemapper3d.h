@@ -4,9 +4,30 @@
 #include <mitkGLMapper.h>
 #include <mitkCoreServices.h>
 
+#include <stdio.h>
+#include <map>
+#include <memory>
+
+#include <QElapsedTimer>
+
+#include "transferfunctionbaker.h"
+
+class ClassifiedVolume;
+class GLStateCache;
+class GpuTimer;
+class GradientTransferTable;
+class PreIntegrationTable;
+class RenderTargetPool;
+class ResolutionController;
+class RollingStatistics;
 class ShaderProgram;
+class ShadingTable;
+class TransferFunctionLibrary;
+class TransferTable;
 
+class vtkColorTransferFunction;
 class vtkImageData;
+class vtkPiecewiseFunction;
 class vtkWindow;
 
 class VolumeMapper3D : public mitk::GLMapper
@@ -23,6 +44,106 @@ public:
 		PREVIEW, DEMO
 	};
 
+	// POINT classifies each sample on its own, PREINTEGRATED classifies whole ray segments
+	// between two samples. The latter allows larger steps without missing thin features.
+	// DENSITY_GRADIENT classifies each sample by density and gradient magnitude, using the
+	// gradient opacity of two-dimensional transfer functions instead of a fixed modulation.
+	// PRECLASSIFIED renders a volume classified with the current transfer function on the CPU,
+	// without blending or lighting. Point classification fills in until it has been baked.
+	enum ClassificationMode {
+		POINT, PREINTEGRATED, DENSITY_GRADIENT, PRECLASSIFIED
+	};
+
+	enum GradientMethod {
+		CENTRAL, FORWARD
+	};
+
+	// EXACT evaluates lighting and silhouette modulation for every sample, TABLE looks them up
+	// in a table built once per frame. COMPARE renders like TABLE and additionally renders the
+	// first frame of every new view with both and collects the differences between them.
+	enum ShadingMode {
+		EXACT, TABLE, COMPARE
+	};
+
+	// Largest number of transfer functions shown side by side
+	static const int MAX_FAN_OUT = 4;
+
+	// Optional features of the ray casting shader. Every combination in use is compiled into
+	// its own program variant, so disabled features cost nothing in the ray loop.
+	enum ShaderFeature {
+		FEATURE_LIGHTING = 1,
+		FEATURE_MODULATION = 2,
+		FEATURE_FORWARD_GRADIENT = 4,
+		FEATURE_PREINTEGRATED = 8,
+		FEATURE_BLEND_TRANSFER = 16,
+		FEATURE_SKIP_EMPTY = 32,
+		FEATURE_JITTER = 64,
+		FEATURE_CLASSIFY_2D = 128,
+		FEATURE_FAN_OUT_2 = 256,
+		FEATURE_FAN_OUT_3 = 512,
+		FEATURE_FAN_OUT_4 = 1024,
+		FEATURE_CAPTURE_SAMPLES = 2048,
+		FEATURE_CACHED_SAMPLES = 4096,
+		FEATURE_PRECLASSIFIED = 8192,
+		FEATURE_SHADING_TABLE = 16384
+	};
+
+	// Passes measured with GPU timer queries. PASS_UPLOAD covers all texture updates,
+	// PASS_COMPOSITE the upsampling and progressive refinement passes.
+	enum RenderPass
+	{
+		PASS_UPLOAD,
+		PASS_RAY_SETUP,
+		PASS_VOLUME,
+		PASS_COMPOSITE
+	};
+
+	static const int NR_RENDER_PASSES = 4;
+
+	// GPU times of a pass in milliseconds, over the last 256 frames
+	struct PassTiming
+	{
+		float min;
+		float average;
+		float p99;
+		int samples;
+	};
+
+	// Offscreen targets, all allocated from the pool of each local storage
+	enum RenderTarget
+	{
+		TARGET_FRONTFACES,
+		TARGET_BACKFACES,
+		TARGET_ACCUMULATION,
+		TARGET_REDUCED,
+
+		// Frames rendered for comparing the shading table with exact shading
+		TARGET_COMPARE,
+
+		// First of MAX_FAN_OUT targets, one per side-by-side view
+		TARGET_FAN_OUT
+	};
+
+	static const int NR_RENDER_TARGETS = TARGET_FAN_OUT + MAX_FAN_OUT;
+
+	// Everything that affects the rendered image. Progressive refinement starts over
+	// whenever the state of a frame differs from the previous one.
+	struct FrameState
+	{
+		float view[16];
+		float projection[16];
+		float model[16];
+		float transferindex;
+		unsigned int transferversion;
+		unsigned int gradientversion;
+		unsigned int fanoutversion;
+		unsigned int classifieduploads;
+		unsigned int features;
+		uint64_t volumetimestamp;
+		int size[2];
+		int targetsize[2];
+	};
+
 	class LocalStorage
 	{
 	public:
@@ -30,10 +151,30 @@ public:
 		~LocalStorage();
 
 		vtkWindow *window;
-		int windowsize[2];
+		GLStateCache *glstate;
+
+		// OpenGL::ErrorMode last applied to the context, or -1
+		int errormode;
 
 		ShaderProgram *raysetupprogram;
 		ShaderProgram *raycastprogram;
+
+		// All ray casting variants built so far, by feature bits. raycastprogram points to
+		// the variant used in the current frame.
+		std::map<unsigned int, ShaderProgram*> raycastprograms;
+		unsigned int raycastfeatures;
+
+		GpuTimer *raycasttimer;
+
+		// GPU time of the ray setup pass and its latest result
+		GpuTimer *setuptimer;
+		float setuptime;
+
+		GpuTimer *uploadtimer;
+		GpuTimer *compositetimer;
+
+		ShaderProgram *compositeprogram;
+		ShaderProgram *upsampleprogram;
 		
 		unsigned int vertexarray;
 		
@@ -42,21 +183,149 @@ public:
 
 		unsigned int quadvertexbuffer;
 
-		unsigned int frontbackfacefbos[2];
-		unsigned int frontbackfacetextures[2];
+		// Uniform buffer holding the FrameData block of all programs
+		unsigned int framedatabuffer;
+
+		// Front and back faces, the running average of jittered frames for progressive
+		// refinement and the volume rendered at reduced resolution while in motion
+		RenderTargetPool *targets;
+		int accumulatedframes;
+		FrameState framestate;
 
 		unsigned int volumetexture;
 		uint64_t volumetimestamp;
 
+		// Geometry MTime the bounds vertex buffer has been built from
+		uint64_t boundstimestamp;
+
+		// Number and size of uploads to the GPU during the current frame
+		int uploads;
+		long long uploadbytes;
+
 		unsigned int transfertexture;
+		unsigned int transferversion;
+
+		// Layers are allocated in powers of two, so adding a transfer function rarely
+		// reallocates the texture
+		unsigned int preintegrationtexture;
+		int preintegrationlayers;
+		std::vector<unsigned int> preintegrationversions;
+
+		// Two-dimensional transfer functions, allocated the same way
+		unsigned int gradienttexture;
+		int gradientlayers;
+		std::vector<unsigned int> gradientversions;
+
+		// Framebuffer writing to all fan-out targets at once and the number of its attachments
+		unsigned int fanoutframebuffer;
+		int fanoutoutputs;
 
+		// Point classified transfer functions of the side-by-side views, one per layer
+		unsigned int fanouttexture;
+		unsigned int fanoutversion;
+
+		// Gradient and density of the first samples of each ray, one sample per layer of an
+		// RGBA16 array texture. samplecachekey is the state the samples have been captured
+		// for, lastcachekey the one of the previous frame.
+		unsigned int samplecache;
+		unsigned int samplecacheframebuffer;
+		int samplecachesize[3];
+		bool samplecachevalid;
+		FrameState samplecachekey;
+		FrameState lastcachekey;
+
+		// Classified volume, its size and the version of each uploaded brick. Missing bricks
+		// have never been uploaded, the volume is only rendered once there are none.
+		unsigned int classifiedtexture;
+		int classifieddim[3];
+		std::vector<unsigned int> classifiedversions;
+		int classifiedmissing;
+		unsigned int classifieduploads;
+
+		// True once all bricks of the last transfer function are baked and uploaded
+		bool classifiedsettled;
+
+		// Shading table for the camera of this renderer and whether the current view has been
+		// compared with exact shading
+		ShadingTable *shadingtable;
+		unsigned int shadingtexture;
+		bool shadingcompared;
+
+		// Saved framebuffer bindings. Reserved for MAX_FRAMEBUFFER_SAVES nested saves, so
+		// Paint never reallocates it.
 		std::vector<int> fbostack;
 	};
 
-	void SetTransferTexture(int nrfunctions, unsigned char *data);
+	// SetTransferFunctionLibrary sets the transfer functions shown in demo mode and resets the
+	// transfer function index. Later changes to the library are picked up by Paint.
+	void SetTransferFunctionLibrary(const std::shared_ptr<TransferFunctionLibrary> &library);
 	void SetTransferFunctionIndex(float index);
 	float GetTransferFunctionIndex();
 	void SetDisplayMode(DisplayMode m);
+	void SetClassificationMode(ClassificationMode m);
+	void SetLightingEnabled(bool enabled);
+	void SetOpacityModulationEnabled(bool enabled);
+	void SetGradientMethod(GradientMethod m);
+	void SetEmptySpaceSkippingEnabled(bool enabled);
+	void SetShadingMode(ShadingMode m);
+
+	// With a count > 1, demo mode shows up to MAX_FAN_OUT consecutive transfer functions of the
+	// library side by side, starting at the current one. Every ray is traversed once and each
+	// sample is classified with all of them. Progressive refinement and reduced resolution
+	// frames are not used while more than one view is shown.
+	void SetFanOut(int count);
+	int GetFanOut();
+
+	// With a budget in megabytes (0 disables it), the density and gradient of the first samples
+	// along each ray are captured once the camera has come to rest. Later frames only classify
+	// and composite those samples until camera, volume or window change, which makes transfer
+	// function transitions much cheaper. The number of cached samples per ray is limited by the
+	// budget and the window size, rays continue with regular sampling after them.
+	void SetSampleCacheBudget(int megabytes);
+	int GetSampleCacheBudget();
+
+	// With progressive refinement, frames are rendered with a coarse step and jittered ray
+	// starts, and accumulated until the image has converged. Any change of camera, transfer
+	// function or volume starts over. IsConverged returns true once no more frames are needed.
+	void SetProgressiveRefinementEnabled(bool enabled);
+	bool IsConverged();
+
+	// Resolution of the volume pass relative to the window (1/4 to 1) while the view is in
+	// motion. The result is upsampled to the window, taking the edges of the bounding box
+	// into account. Frames without camera or volume motion are rendered at full resolution.
+	void SetRenderScale(float scale);
+	float GetRenderScale();
+
+	// With a frame time budget in milliseconds (0 disables it), render scale and ray step
+	// length of frames in motion are chosen automatically from the measured GPU time of the
+	// ray setup and volume passes. SetRenderScale has no effect then.
+	void SetFrameTimeBudget(float ms);
+	float GetFrameTimeBudget();
+
+	// PrintShaderVariantTimes writes the average GPU time of the ray casting pass for each
+	// shader variant used so far.
+	void PrintShaderVariantTimes(FILE *out);
+
+	// GetPassTiming returns the rolling GPU time statistics of a pass. Results arrive a few
+	// frames late. Returns false if there are no measurements yet.
+	bool GetPassTiming(RenderPass pass, PassTiming &timing);
+
+	// With an interval > 0, the statistics of all passes are written to stdout every
+	// interval frames.
+	void SetPassTimingLogInterval(int frames);
+
+	// PrintGLStateStatistics writes the average number of GL state changes per frame, how
+	// many of them were skipped because the state was already set, the average number and
+	// size of uploads to the GPU, and the CPU time spent in Paint.
+	void PrintGLStateStatistics(FILE *out);
+
+	// GetAllocationCheckFrames returns the number of frames checked for heap allocations so
+	// far, which is 0 unless allocations are counted
+	int GetAllocationCheckFrames();
+
+	// PrintShadingDifference writes how much frames rendered with the shading table differ
+	// from exact shading, if frames have been compared with ShadingMode::COMPARE.
+	void PrintShadingDifference(FILE *out);
 	void Paint(mitk::BaseRenderer *renderer);
 
 protected:
@@ -65,13 +334,185 @@ protected:
 
 	mitk::LocalStorageHandler<LocalStorage> storagehandler;
 	bool glinit;
-	vtkImageData *pendingtexture;
 	DisplayMode displaymode;
 	float transferindex;
 
+	ClassificationMode classificationmode;
+	GradientMethod gradientmethod;
+	bool lighting;
+	bool modulation;
+	bool emptyspaceskipping;
+	ShadingMode shadingmode;
+
+	struct VariantTime
+	{
+		double total;
+		int frames;
+	};
+
+	std::map<unsigned int, VariantTime> varianttimes;
+
+	struct GLCallCount
+	{
+		long long issued;
+		long long skipped;
+		long long queries;
+		long long uploads;
+		long long uploadbytes;
+		double painttime;
+		int frames;
+
+		// Heap allocations in Paint after the warm-up frames and the number of frames checked,
+		// if counted at all
+		long long allocations;
+		int allocationframes;
+	};
+
+	GLCallCount glcalls;
+
+	// Differences between frames rendered with the shading table and with exact shading, in
+	// 8 bit levels over all channels of all compared pixels
+	struct ShadingDifference
+	{
+		long long values;
+		long long above;
+		double sum;
+		double sumsquares;
+		int max;
+		int frames;
+	};
+
+	ShadingDifference shadingdifference;
+
+	// Read back frames of the last comparison, table and exact
+	std::vector<unsigned char> shadingimages[2];
+
+	// Inverse model matrix, recomputed only if the geometry or its transform has been modified.
+	// Geometry and VTK transform use separate clocks.
+	struct ModelStamp
+	{
+		const void *geometry;
+		uint64_t geometrytime;
+		uint64_t transformtime;
+	};
+
+	ModelStamp modelstamp;
+	bool modelvalid;
+	float inversemodel[16];
+
+	// Transfer functions shared with the panel. The version is incremented whenever the
+	// library or its version (libraryversion) changes.
+	std::shared_ptr<TransferFunctionLibrary> library;
+	unsigned int libraryversion;
+	int nrtransferrows;
+	unsigned int transferversion;
+
+	// Transfer function of the current frame, blended from the two active rows. The ray caster
+	// only needs a single lookup per sample this way. blendedrows is the transferversion the
+	// blend has been computed from, or 0 if blendedtransfer holds the preview function.
+	std::vector<float> blendedtransfer;
+	unsigned int blendedversion;
+	float blendedindex;
+	unsigned int blendedrows;
+
+	// Entries changed by the last increment of blendedversion. Storages one version behind
+	// only upload these.
+	int blendedfirst;
+	int blendedcount;
+
+	// Modification times of the transfer function shown in preview mode
+	struct PreviewStamp
+	{
+		uint64_t function;
+		uint64_t color;
+		uint64_t opacity;
+		uint64_t gradient;
+	};
+
+	// Preview transfer function, baked only if its stamp differs from the last one. Only the
+	// entries affected by changed nodes are baked again. The version is incremented on every
+	// bake, previewtableversion is the one pre-integrated last.
+	std::vector<unsigned char> previewrow;
+	TransferFunctionNodes previewnodes;
+	PreviewStamp previewstamp;
+	bool previewvalid;
+	unsigned int previewversion;
+	unsigned int previewtableversion;
+
+	// Gradient opacity of the preview transfer function, unless it is fully opaque. The version
+	// is incremented on every bake, previewgradienttableversion is the one built last.
+	std::vector<unsigned char> previewgradient;
+	bool previewhasgradient;
+	unsigned int previewgradientversion;
+	unsigned int previewgradienttableversion;
+
+	// Pre-integrated tables for both display modes, indexed by DisplayMode. The demo table has
+	// one row per library slot and is up to date with preintegrationversion of the library.
+	PreIntegrationTable *preintegration[2];
+	const TransferFunctionLibrary *preintegrationlibrary;
+	unsigned int preintegrationversion;
+	std::vector<int> changedslots;
+
+	// Two-dimensional tables for both display modes, maintained like the pre-integrated ones
+	GradientTransferTable *gradienttables[2];
+	const TransferFunctionLibrary *gradientlibrary;
+	unsigned int gradientlibraryversion;
+
+	// Requested number of side-by-side views and the library slots shown by each one. The
+	// version is incremented whenever the slots or their rows change.
+	int fanout;
+	int fanoutslots[MAX_FAN_OUT];
+	int fanoutcount;
+	int fanoutbase;
+	unsigned int fanoutrows;
+	unsigned int fanoutversion;
+
+	int samplecachebudget;
+
+	// Volume classified on the CPU, only while pre-classification is selected. It has been
+	// baked from the volume with the given MTime and from the current row of the given display
+	// mode: the preview version, or the transfer version and the row's library position.
+	ClassifiedVolume *classifiedvolume;
+	uint64_t classifiedtimestamp;
+	DisplayMode classifiedmode;
+	unsigned int classifiedversion;
+	int classifiedposition;
+	bool classifiedmodulation;
+
+	// Startup statistics, reported once after the first frame
+	QElapsedTimer startuptimer;
+	bool firstframe;
+	int builtprograms;
+	int cachedprograms;
+	double programbuildtime;
+
+	bool progressive;
+	bool converged;
+
+	float renderscale;
+
+	float frametimebudget;
+	ResolutionController *resolutioncontroller;
+
+	RollingStatistics *passtimes[NR_RENDER_PASSES];
+	int passtiminglog;
+	int passtimingframes;
+
 	void SaveWindow(mitk::BaseRenderer *renderer);
 
-	void UpdateShaderProgram(mitk::BaseRenderer *renderer, ShaderProgram *&program, const char *vfile, const char *ffile);
+	void UpdateShaderProgram(mitk::BaseRenderer *renderer, ShaderProgram *&program, const char *vfile, const char *ffile, const char *defines = NULL);
+	void InitializeProgram(mitk::BaseRenderer *renderer, ShaderProgram *program);
+
+	// GetRaycastFeatures returns the cheapest combination of shader features that renders
+	// the current settings.
+	unsigned int GetRaycastFeatures(mitk::BaseRenderer *renderer);
+
+	// GetRaycastProgram returns the ray casting variant with the given features, which is
+	// built on first use
+	ShaderProgram *GetRaycastProgram(mitk::BaseRenderer *renderer, unsigned int features);
+	void UpdateRaycastProgram(mitk::BaseRenderer *renderer);
+	void CollectGpuTimes(mitk::BaseRenderer *renderer);
+	void LogPassTimings();
 
 	void UpdateVolumeTexture(mitk::BaseRenderer *renderer);
 
@@ -79,7 +520,45 @@ protected:
 
 	void UpdateTransferTexture(mitk::BaseRenderer *renderer);
 	void UpdateTransferTextureDemo(mitk::BaseRenderer *renderer);
+	void UpdateTransferRows();
+
+	// UpdateTableRows rebuilds the rows of a demo mode table whose library slots have changed
+	// since the given library and version were seen, and updates both
+	void UpdateTableRows(TransferTable *table, const TransferFunctionLibrary *&seenlibrary, unsigned int &seenversion);
+
+	void UpdateFanOutRows();
+	void UploadFanOutTexture(mitk::BaseRenderer *renderer);
+
+	// GetFanOutCount returns the number of views rendered in the current frame, which is 1
+	// unless in demo mode with more than one transfer function
+	int GetFanOutCount();
+
+	// GetRenderSize returns the size of a single view in pixels
+	void GetRenderSize(mitk::BaseRenderer *renderer, int size[2]);
+
+	// CollectChangedSlots stores the library slots changed since the given library and version
+	// were seen in changedslots. Returns false if nothing has changed.
+	bool CollectChangedSlots(const TransferFunctionLibrary *seenlibrary, unsigned int seenversion);
+	void GetTransferLayers(float layers[2]);
 	void UpdateTransferTexturePreview(mitk::BaseRenderer *renderer);
+	bool BakePreviewRow(vtkColorTransferFunction *color, vtkPiecewiseFunction *opacity, int &first, int &count);
+	void BlendTransferFunctions();
+	void UploadTransferTexture(mitk::BaseRenderer *renderer);
+	void CountUpload(mitk::BaseRenderer *renderer, size_t bytes);
+
+	// UpdateTableTexture uploads the rows of a table which have changed since the last call to
+	// a texture array with one layer per row. Layers and versions belong to the texture.
+	void UpdateTableTexture(mitk::BaseRenderer *renderer, TransferTable *table, unsigned int &texture, int &layers, std::vector<unsigned int> &versions);
+
+	// UpdateClassifiedVolume starts baking the classified volume whenever the volume or the
+	// current transfer function have changed. UpdateClassifiedTexture uploads the bricks
+	// baked since the last frame.
+	void UpdateClassifiedVolume();
+	void UpdateClassifiedTexture(mitk::BaseRenderer *renderer);
+
+	// UpdateShadingTexture rebuilds and uploads the shading table whenever the view direction
+	// has changed
+	void UpdateShadingTexture(mitk::BaseRenderer *renderer);
 
 	// ReadFile opens a file or embedded Qt resource and returns its whole contents as an
 	// null-terminated array of bytes. If parameter size is not NULL, the total number of bytes
@@ -96,7 +575,25 @@ protected:
 	void RestoreFramebufferState(mitk::BaseRenderer *renderer);
 
 	void RenderBoundingBox(mitk::BaseRenderer *renderer);
-	void RenderVolume(mitk::BaseRenderer *renderer);
+	void RenderVolume(mitk::BaseRenderer *renderer, float stepfactor = 1.0f, unsigned int tag = 0);
+	void RenderProgressive(mitk::BaseRenderer *renderer, unsigned int tag);
+	void RenderReduced(mitk::BaseRenderer *renderer, float scale, float stepfactor, unsigned int tag);
+	void RenderFanOut(mitk::BaseRenderer *renderer, float stepfactor, unsigned int tag);
+
+	// UpdateSampleCache returns true if the current frame is rendered from the sample cache,
+	// (re)allocating the cache if necessary. The samples are captured by RenderCached.
+	bool UpdateSampleCache(mitk::BaseRenderer *renderer, const FrameState &state);
+	void CaptureSamples(mitk::BaseRenderer *renderer);
+	void RenderCached(mitk::BaseRenderer *renderer, unsigned int tag);
+
+	// CompareShading renders the current view at full quality with the shading table and with
+	// exact shading, reads both back and adds their differences to shadingdifference
+	void CompareShading(mitk::BaseRenderer *renderer);
+	void RenderComposite(mitk::BaseRenderer *renderer, unsigned int texture);
+	void BindQuadVertexBuffer(mitk::BaseRenderer *renderer);
+
+	void GetFrameState(mitk::BaseRenderer *renderer, FrameState &state);
+	void UpdateFrameData(mitk::BaseRenderer *renderer, const FrameState &state);
 
 	void GetViewMatrix(mitk::BaseRenderer *renderer, float matrix[16]);
 	void GetProjectionMatrix(mitk::BaseRenderer *renderer, float matrix[16]);